@@ -16,6 +16,13 @@ public:
     double shutter_open_time = 0;
     double shutter_close_time = 0;
 
+    // Kept to derive moved cameras from this one.
+    Point3 target = Point3(0, 0, 0);
+    Vec3 up = Vec3(0, 1, 0);
+    double field_of_view = 0;
+    double aspect = 0;
+    double focus = 0;
+
     Camera() = default;
 
     Camera(
@@ -28,7 +35,9 @@ public:
             double focus_distance,
             double open_time = 0,
             double close_time = 0
-    ) : origin(look_from), lens_radius(aperture / 2), shutter_open_time(open_time), shutter_close_time(close_time) {
+    ) : origin(look_from), lens_radius(aperture / 2), shutter_open_time(open_time), shutter_close_time(close_time),
+        target(look_at), up(view_up), field_of_view(vertical_field_of_view), aspect(aspect_ratio),
+        focus(focus_distance) {
         auto theta = degrees_to_radians(vertical_field_of_view);
         auto h = tan(theta / 2);
         auto viewport_height = 2.0 * h;
@@ -50,6 +59,36 @@ public:
                 lower_left_corner + s * horizontal + t * vertical - origin - offset,
                 random_double(shutter_open_time, shutter_close_time)};
     }
+
+    // The ray through (s, t), with the rays through (s + ds, t) and (s, t + dt) from the same point on the lens.
+    [[nodiscard]] Ray get_ray(double s, double t, double ds, double dt, Ray_differential &differential) const {
+        auto ray = get_ray(s, t);
+        differential.valid = true;
+        differential.x_origin = ray.origin();
+        differential.x_direction = ray.direction() + ds * horizontal;
+        differential.y_origin = ray.origin();
+        differential.y_direction = ray.direction() + dt * vertical;
+        return ray;
+    }
+
+    // This camera circled around its target about the up axis by degrees, with a new shutter interval.
+    [[nodiscard]] Camera orbited(double degrees, double open_time, double close_time) const {
+        auto axis = unit_vector(up);
+        auto offset = origin - target;
+        auto radians = degrees_to_radians(degrees);
+
+        // Rodrigues' rotation of the offset about the axis
+        auto rotated = offset * cos(radians) + cross(axis, offset) * sin(radians) +
+                       axis * dot(axis, offset) * (1 - cos(radians));
+
+        return {target + rotated, target, up, field_of_view, aspect, 2 * lens_radius, focus, open_time, close_time};
+    }
+
+    // This camera with a viewport of another aspect ratio, keeping the vertical field of view.
+    [[nodiscard]] Camera reshaped(double aspect_ratio) const {
+        return {origin, target, up, field_of_view, aspect_ratio, 2 * lens_radius, focus, shutter_open_time,
+                shutter_close_time};
+    }
 };
 
 #endif //RAY_TRACING_IN_CPP_CAMERA_H
@@ -1,34 +1,183 @@
 #ifndef RAY_TRACING_IN_CPP_COLOR_H
 #define RAY_TRACING_IN_CPP_COLOR_H
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+#include <vector>
 
 #include "Vec3.h"
 
-#include <iostream>
+enum class Tonemap { clamp, reinhard, aces };
 
-void write_color(std::ostream &out, Color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+// Display encodings: gamma 2 (a square root, what images have always used) or the sRGB curve.
+enum class Transfer { gamma2, srgb };
 
-    // Divide the color by the number of samples and gamma-correct for gamma=2.0. (sqrt(x) === pow(x, 1/2)
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
+inline bool parse_tonemap(std::string_view name, Tonemap &tonemap) {
+    if (name == "clamp") {
+        tonemap = Tonemap::clamp;
+    } else if (name == "reinhard") {
+        tonemap = Tonemap::reinhard;
+    } else if (name == "aces") {
+        tonemap = Tonemap::aces;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-    // Write the translated [0, 255] value for each component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+inline bool parse_transfer(std::string_view name, Transfer &transfer) {
+    if (name == "gamma2") {
+        transfer = Transfer::gamma2;
+    } else if (name == "srgb") {
+        transfer = Transfer::srgb;
+    } else {
+        return false;
+    }
+    return true;
 }
 
-void write_color(std::ostream &out, Color pixel_color) {
-    // Write the translated [0, 255] value for each component.
-    out << static_cast<int>(256 * clamp(pixel_color.x(), 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(pixel_color.y(), 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(pixel_color.z(), 0.0, 0.999)) << '\n';
+// How linear pixel averages become output samples: scaled by 2^exposure, tonemapped, encoded for display and
+// quantized to bits per sample, with 8x8 ordered dithering when asked. Runs a row at a time over plain float arrays,
+// four samples per SSE2 instruction when the build has it. The defaults reproduce the plain gamma 2, 8-bit output
+// (256 * clamp(sqrt(x), 0, 0.999) in double precision) exactly.
+struct Post_process {
+    double exposure = 0.0;              // stops
+    Tonemap tonemap = Tonemap::clamp;
+    Transfer transfer = Transfer::gamma2;
+    int bits = 8;                       // 8 or 16
+    bool dither = false;
+
+    // Turn count linear samples (three per pixel) of image row into codes; values is used as scratch.
+    void run(float *values, int count, int row, std::uint16_t *codes) const;
+};
+
+const int srgb_table_size = 4096;
+
+// sRGB encoding of srgb_table_size + 1 evenly spaced values over [0, 1], to interpolate between.
+inline const std::vector<float> &srgb_table() {
+    static const std::vector<float> table = [] {
+        std::vector<float> entries(srgb_table_size + 1);
+        for (int i = 0; i <= srgb_table_size; ++i) {
+            auto x = double(i) / srgb_table_size;
+            entries[i] = static_cast<float>(x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1 / 2.4) - 0.055);
+        }
+        return entries;
+    }();
+    return table;
 }
 
+// Values in [0, 1]. The linear toe is computed directly; the interpolation error above it stays below 1e-6.
+inline float srgb_encode(float x) {
+    if (x <= 0.0031308f) { return 12.92f * std::max(x, 0.0f); }
+
+    const auto &table = srgb_table();
+    auto position = std::min(x, 1.0f) * srgb_table_size;
+    auto index = std::min(static_cast<int>(position), srgb_table_size - 1);
+    auto fraction = position - static_cast<float>(index);
+    return table[index] + fraction * (table[index + 1] - table[index]);
+}
+
+// Ordered dithering thresholds.
+const int bayer_matrix[8][8] = {
+        {0,  32, 8,  40, 2,  34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44, 4,  36, 14, 46, 6,  38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        {3,  35, 11, 43, 1,  33, 9,  41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47, 7,  39, 13, 45, 5,  37},
+        {63, 31, 55, 23, 61, 29, 53, 21}};
+
+void Post_process::run(float *values, int count, int row, std::uint16_t *codes) const {
+    const auto scale = static_cast<float>(std::exp2(exposure));
+    const auto levels = static_cast<float>(1 << bits);
+    const auto top = levels - 1;
+
+    // Without dithering, levels even buckets over [0, 1]; with it, rounding to the nearest of levels codes after an
+    // offset within half a step, the same for the three samples of a pixel.
+    const auto factor = dither ? top : levels;
+    float offsets[24];
+    for (int i = 0; i < 24; ++i) {
+        offsets[i] = dither ? static_cast<float>((bayer_matrix[row & 7][i / 3] + 0.5) / 64) : 0.0f;
+    }
+
+    // A square root rounded in single precision can land on k / 256 from just below (k / 256)^2, which double
+    // precision never does; comparing with that threshold, exact in a float for 8 bits, takes the code back down.
+    const auto exact_gamma2 = transfer == Transfer::gamma2 && bits == 8 && !dither;
+
+    int i = 0;
+#if defined(__SSE2__)
+    const auto scale_4 = _mm_set1_ps(scale);
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps(1.0f);
+    const auto factor_4 = _mm_set1_ps(factor);
+    const auto top_4 = _mm_set1_ps(top);
+    const auto step_squared = _mm_set1_ps(1.0f / 65536);
+    const auto bias = _mm_set1_epi32(32768);
+    const auto sign = _mm_set1_epi16(static_cast<short>(0x8000));
+
+    // 24 samples at a time, one period of the dither pattern.
+    for (; i + 24 <= count; i += 24) {
+        for (int j = 0; j < 24; j += 8) {
+            __m128 x[2];
+            for (int h = 0; h < 2; ++h) {
+                // max with zero second also turns NaN into 0.
+                auto v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(values + i + j + 4 * h), scale_4), zero);
+                if (tonemap == Tonemap::reinhard) {
+                    v = _mm_div_ps(v, _mm_add_ps(one, v));
+                } else if (tonemap == Tonemap::aces) {
+                    auto numerator = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), v), _mm_set1_ps(0.03f)));
+                    auto denominator = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), v),
+                                                                           _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+                    v = _mm_min_ps(_mm_div_ps(numerator, denominator), one);
+                }
+
+                __m128 encoded;
+                if (transfer == Transfer::srgb) {
+                    alignas(16) float lanes[4];
+                    _mm_store_ps(lanes, v);
+                    for (auto &lane: lanes) { lane = srgb_encode(lane); }
+                    encoded = _mm_load_ps(lanes);
+                } else {
+                    encoded = _mm_sqrt_ps(v);
+                }
+
+                auto scaled = _mm_add_ps(_mm_mul_ps(encoded, factor_4), _mm_loadu_ps(offsets + j + 4 * h));
+                x[h] = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(scaled, top_4)));
+                if (exact_gamma2) {
+                    auto threshold = _mm_mul_ps(_mm_mul_ps(x[h], x[h]), step_squared);
+                    x[h] = _mm_sub_ps(x[h], _mm_and_ps(_mm_cmplt_ps(v, threshold), one));
+                }
+            }
+
+            // Unsigned 16-bit codes through the signed saturating pack.
+            auto low = _mm_sub_epi32(_mm_cvttps_epi32(x[0]), bias);
+            auto high = _mm_sub_epi32(_mm_cvttps_epi32(x[1]), bias);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + i + j),
+                             _mm_xor_si128(_mm_packs_epi32(low, high), sign));
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        auto v = values[i] * scale;
+        v = v > 0 ? v : 0.0f;
+        if (tonemap == Tonemap::reinhard) {
+            v = v / (1 + v);
+        } else if (tonemap == Tonemap::aces) {
+            v = std::min(v * (2.51f * v + 0.03f) / (v * (2.43f * v + 0.59f) + 0.14f), 1.0f);
+        }
+
+        auto encoded = transfer == Transfer::srgb ? srgb_encode(v) : std::sqrt(v);
+        auto code = std::floor(std::min(encoded * factor + offsets[i % 24], top));
+        if (exact_gamma2 && v < code * code / 65536) { code -= 1; }
+        codes[i] = static_cast<std::uint16_t>(code);
+    }
+}
 
 #endif //RAY_TRACING_IN_CPP_COLOR_H
@@ -6,16 +6,32 @@
 #include "aabb.h"
 #include "util.h"
 
+class Hittable;
+class Light_collector;
 class Material;
 
+// Closest hit along a ray, filled in two phases. While the scene is traversed, hit() records only the distance, the
+// primitive that was hit and whatever that primitive needs to find the rest again (an index into a set of
+// primitives, local surface parameters in u and v), so a candidate that a closer hit later replaces costs no
+// shading work. finalize_hit then computes the point, normal, texture coordinates and material of the winner.
 struct Hit_record {
+    double t = 0.0;
+    const Hittable *object = nullptr;   // finalizes the hit; null once finalized
+    int index = 0;
+    double u = 0.0;
+    double v = 0.0;
+
     Point3 point;
     Vec3 normal;
-    shared_ptr<Material> material_ptr;
-    double t = 0.0;
-    double u;
-    double v;
+    const Material *material_ptr = nullptr;
     bool front_face = false;
+    double footprint = 0.0;             // width of a pixel at the point, 0 when unknown; see Ray_differential
+
+    inline void set_hit(double _t, const Hittable *_object, int _index = 0) {
+        t = _t;
+        object = _object;
+        index = _index;
+    }
 
     inline void set_face_normal(const Ray &ray, const Vec3 &outward_normal) {
         front_face = dot(ray.direction(), outward_normal) < 0;
@@ -27,11 +43,57 @@ class Hittable {
 public:
     virtual ~Hittable() = default;
 
+    // Record the closest hit in (t_min, t_max) for finalize_hit; rec is left untouched when there is none.
     virtual bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const = 0;
 
+    // Complete a hit this object recorded on the same ray. Only primitives that set themselves as the record's
+    // object are asked; aggregates never are.
+    virtual void finalize_hit(const Ray &ray, Hit_record &rec) const {}
+
     virtual bool bounding_box(double time0, double time1, AABB &output_box) const = 0;
+
+    // Entry and exit distances of the whole (unclipped) ray through this object, treated as a closed convex volume.
+    // Volumes use it to find the segment they fill; the default costs two hit queries, primitives answer in one.
+    virtual bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const;
+
+    // Boxes bounding the object at time0 and at time1 such that blending them linearly by time bounds it at any
+    // moment in between. The default gives the box of the whole interval for both, which suits static objects.
+    virtual bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const;
+
+    // Recompute any cached bounds for the interval [time0, time1]; objects that compute them on demand do nothing.
+    virtual void refit(double time0, double time1) {}
+
+    // Hand the emitters in this object to collector for direct light sampling, moved by offset into world space.
+    // Under a transform the collector can't follow, sampleable is false and emitters are only reported as such.
+    virtual void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const {}
 };
 
+// Complete the closest hit found by Hittable::hit.
+inline void finalize_hit(const Ray &ray, Hit_record &rec) {
+    if (rec.object == nullptr) { return; }
+    rec.object->finalize_hit(ray, rec);
+    rec.object = nullptr;
+}
+
+bool Hittable::boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const {
+    Hit_record enter_record;
+    Hit_record exit_record;
+
+    if (!hit(ray, -infinity, infinity, enter_record)) { return false; }
+    if (!hit(ray, enter_record.t + 0.0001, infinity, exit_record)) { return false; }
+
+    t_enter = enter_record.t;
+    t_exit = exit_record.t;
+
+    return true;
+}
+
+bool Hittable::motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const {
+    if (!bounding_box(time0, time1, box0)) { return false; }
+    box1 = box0;
+    return true;
+}
+
 class Translate : public Hittable {
 public:
     Vec3 offset;
@@ -42,12 +104,41 @@ public:
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
 
     bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override {
+        return object->boundary_interval(moved(ray), t_enter, t_exit);
+    }
+
+    bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const override {
+        if (!object->motion_bounds(time0, time1, box0, box1)) { return false; }
+        box0 = AABB(box0.min() + offset, box0.max() + offset);
+        box1 = AABB(box1.min() + offset, box1.max() + offset);
+        return true;
+    }
+
+    void refit(double time0, double time1) override { object->refit(time0, time1); }
+
+    void collect_lights(Light_collector &collector, const Vec3 &_offset, bool sampleable) const override {
+        object->collect_lights(collector, _offset + offset, sampleable);
+    }
+
+private:
+    // The ray in the object's space; only the origin moves, so the direction data is copied rather than recomputed.
+    [[nodiscard]] Ray moved(const Ray &ray) const {
+        Ray moved_ray = ray;
+        moved_ray.set_origin(ray._origin - offset);
+        return moved_ray;
+    }
 };
 
 bool Translate::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
-    Ray moved_ray(ray.origin() - offset, ray.direction(), ray.time());
+    RT_STAT_PRIMITIVE(Translate);
+
+    auto moved_ray = moved(ray);
     if (!object->hit(moved_ray, t_min, t_max, rec)) { return false; }
 
+    // Instances finalize in their object's space, so the record never has to remember a chain of transforms.
+    ::finalize_hit(moved_ray, rec);
     rec.point += offset;
     rec.set_face_normal(moved_ray, rec.normal);
 
@@ -79,6 +170,21 @@ public:
         return hasbox;
     }
 
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override {
+        return object->boundary_interval(Ray(inverse_rotate(ray.origin()), inverse_rotate(ray.direction()), ray.time()),
+                                         t_enter, t_exit);
+    }
+
+    void refit(double time0, double time1) override {
+        object->refit(time0, time1);
+        hasbox = object->bounding_box(time0, time1, bbox);
+        if (hasbox) { compute_AABB(); }
+    }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        object->collect_lights(collector, offset, false);
+    }
+
     void compute_AABB();
 
 private:
@@ -95,13 +201,13 @@ Rotate::Rotate(const shared_ptr<Hittable> &_object, double angle) : object(_obje
 }
 
 bool Rotate::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
-    auto origin = inverse_rotate(ray.origin());
-    auto direction = inverse_rotate(ray.direction());
+    RT_STAT_PRIMITIVE(Rotate);
 
-    Ray rotated_ray(origin, direction, ray.time());
+    Ray rotated_ray(inverse_rotate(ray._origin), inverse_rotate(ray._direction), ray._time);
 
     if (!object->hit(rotated_ray, t_min, t_max, rec)) { return false; }
 
+    ::finalize_hit(rotated_ray, rec);
     auto point = rotate(rec.point);
     auto normal = rotate(rec.normal);
 
@@ -26,18 +26,26 @@ public:
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
 
     bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const override;
+
+    void refit(double time0, double time1) override {
+        for (const auto &object: objects) { object->refit(time0, time1); }
+    }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        for (const auto &object: objects) { object->collect_lights(collector, offset, sampleable); }
+    }
 };
 
 bool Hittable_list::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
-    Hit_record temp_record;
     bool hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto &object: objects) {
-        if (object->hit(ray, t_min, closest_so_far, temp_record)) {
+        if (object->hit(ray, t_min, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_record.t;
-            rec = temp_record;
+            closest_so_far = rec.t;
         }
     }
 
@@ -59,5 +67,22 @@ bool Hittable_list::bounding_box(double time0, double time1, AABB &output_box) c
     return true;
 }
 
+// The union of the objects' motion bounds: the extremes of linearly blended boxes blend no faster than linearly.
+bool Hittable_list::motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const {
+    if (objects.empty()) { return false; }
+
+    AABB object_box0;
+    AABB object_box1;
+    bool first_box = true;
+
+    for (const auto &object: objects) {
+        if (!object->motion_bounds(time0, time1, object_box0, object_box1)) { return false; }
+        box0 = first_box ? object_box0 : surrounding_box(box0, object_box0);
+        box1 = first_box ? object_box1 : surrounding_box(box1, object_box1);
+        first_box = false;
+    }
+
+    return true;
+}
 
 #endif //RAY_TRACING_IN_CPP_HITTABLE_LIST_H
@@ -7,6 +7,17 @@
 #include "Hittable.h"
 #include "Texture.h"
 
+// The texture's value at a hit, through the thread's Texture_cache.
+inline Color texture_value(const Texture &texture, const Hit_record &record) {
+    return texture_cache().value(texture, record.u, record.v, record.point, record.footprint);
+}
+
+// How a material takes direct light samples (see sample_direct_light): not at all, at a surface facing its normal,
+// or in a volume, in every direction.
+enum class Light_sampling {
+    none, surface, volume
+};
+
 class Material {
 public:
     virtual ~Material() = default;
@@ -16,6 +27,25 @@ public:
     }
 
     virtual bool scatter(const Ray &ray_in, const Hit_record &record, Color &attenuation, Ray &scattered) const = 0;
+
+    [[nodiscard]] virtual Light_sampling light_sampling() const { return Light_sampling::none; }
+
+    // For materials that sample lights: the attenuation per unit solid angle of light arriving from direction (a unit
+    // vector) and leaving along the incoming ray, cosine included.
+    [[nodiscard]] virtual Color scattering_value(const Ray &ray_in, const Hit_record &record,
+                                                 const Vec3 &direction) const {
+        return {0, 0, 0};
+    }
+
+    // Carry the differential of ray_in, already moved onto the hit, along the scattered ray; false when the material
+    // can't follow it. Normals are taken as constant across the footprint.
+    virtual bool scatter_differential(const Ray &ray_in, const Hit_record &record, const Ray &scattered,
+                                      Ray_differential &differential) const {
+        return false;
+    }
+
+    // Whether the light BVH samples this emitter, so that scattered rays leave its emission out.
+    [[nodiscard]] virtual bool sampled_light() const { return false; }
 };
 
 enum class DiffuseType {
@@ -55,6 +85,8 @@ public:
     }
 
     bool scatter(const Ray &ray_in, const Hit_record &record, Color &attenuation, Ray &scattered) const override {
+        RT_STAT_SCATTER(Diffuse);
+
         auto scatter_direction = scatter_direction_function(record.normal);
 
         if (scatter_direction.near_zero()) {
@@ -62,10 +94,20 @@ public:
         }
 
         scattered = Ray(record.point, scatter_direction, ray_in.time());
-        attenuation = albedo->value(record.u, record.v, record.point);
+        attenuation = texture_value(*albedo, record);
         return true;
     }
 
+    // Only the true Lambertian has the cosine distribution that scattering_value describes.
+    [[nodiscard]] Light_sampling light_sampling() const override {
+        return scatter_direction_function == lambertian ? Light_sampling::surface : Light_sampling::none;
+    }
+
+    [[nodiscard]] Color scattering_value(const Ray &ray_in, const Hit_record &record,
+                                         const Vec3 &direction) const override {
+        return texture_value(*albedo, record) * (std::max(0.0, dot(record.normal, direction)) / pi);
+    }
+
 private:
 
     static Vec3 simple(const Vec3 &normal) {
@@ -89,11 +131,22 @@ public:
     Metal(const Color &a, double fuzz) : albedo(a), fuzziness(fuzz < 1 ? fuzz : 1) {}
 
     bool scatter(const Ray &r_in, const Hit_record &rec, Color &attenuation, Ray &scattered) const override {
+        RT_STAT_SCATTER(Metal);
+
         Vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
         scattered = Ray(rec.point, reflected + fuzziness * random_in_unit_sphere(), r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
+
+    // The neighbouring rays are mirrored too and take the same fuzz offset.
+    bool scatter_differential(const Ray &r_in, const Hit_record &rec, const Ray &scattered,
+                              Ray_differential &differential) const override {
+        auto offset = unit_vector(scattered.direction()) - reflect(unit_vector(r_in.direction()), rec.normal);
+        differential.x_direction = reflect(unit_vector(differential.x_direction), rec.normal) + offset;
+        differential.y_direction = reflect(unit_vector(differential.y_direction), rec.normal) + offset;
+        return true;
+    }
 };
 
 class Dielectric : public Material {
@@ -103,6 +156,8 @@ public:
     explicit Dielectric(double index_of_refraction) : _index_of_refraction(index_of_refraction) {}
 
     bool scatter(const Ray &r_in, const Hit_record &rec, Color &attenuation, Ray &scattered) const override {
+        RT_STAT_SCATTER(Dielectric);
+
         attenuation = Color(1.0, 1.0, 1.0);
         double refraction_ratio = rec.front_face ? (1.0 / _index_of_refraction) : _index_of_refraction;
 
@@ -123,6 +178,25 @@ public:
         return true;
     }
 
+    // The neighbouring rays follow the branch the scattered ray took; the chain ends if one of them can't refract.
+    bool scatter_differential(const Ray &r_in, const Hit_record &rec, const Ray &scattered,
+                              Ray_differential &differential) const override {
+        if (dot(scattered.direction(), rec.normal) > 0) {
+            differential.x_direction = reflect(unit_vector(differential.x_direction), rec.normal);
+            differential.y_direction = reflect(unit_vector(differential.y_direction), rec.normal);
+            return true;
+        }
+
+        double refraction_ratio = rec.front_face ? (1.0 / _index_of_refraction) : _index_of_refraction;
+        for (auto *direction: {&differential.x_direction, &differential.y_direction}) {
+            auto unit_direction = unit_vector(*direction);
+            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+            if (refraction_ratio * sqrt(1.0 - cos_theta * cos_theta) > 1.0) { return false; }
+            *direction = refract(unit_direction, rec.normal, refraction_ratio);
+        }
+        return true;
+    }
+
 private:
     static double reflectance(double cosine, double ref_idx) {
         // Use Schlick's approximation for reflectance.
@@ -136,18 +210,22 @@ private:
 class Diffuse_light : public Material  {
 public:
     shared_ptr<Texture> emit;
+    bool sampled = false;   // set by Light_collector
 
     explicit Diffuse_light(shared_ptr<Texture> texture) : emit(std::move(texture)) {}
 
     explicit Diffuse_light(Color color) : emit(make_shared<Solid_color>(color)) {}
 
     bool scatter( const Ray& ray_in, const Hit_record& record, Color& attenuation, Ray& scattered) const override {
+        RT_STAT_SCATTER(Diffuse_light);
         return false;
     }
 
     [[nodiscard]] Color emitted(double u, double v, const Point3& point) const override {
         return emit->value(u, v, point);
     }
+
+    [[nodiscard]] bool sampled_light() const override { return sampled; }
 };
 
 class Isotropic : public Material {
@@ -158,11 +236,19 @@ public:
     explicit Isotropic(shared_ptr<Texture> a) : albedo(std::move(a)) {}
 
     bool scatter(const Ray& ray_in, const Hit_record& record, Color& attenuation, Ray& scattered) const override {
+        RT_STAT_SCATTER(Isotropic);
+
         scattered = Ray(record.point, random_in_unit_sphere(), ray_in.time());
         attenuation = albedo->value(record.u, record.v, record.point);
         return true;
     }
 
+    [[nodiscard]] Light_sampling light_sampling() const override { return Light_sampling::volume; }
+
+    [[nodiscard]] Color scattering_value(const Ray &ray_in, const Hit_record &record,
+                                         const Vec3 &direction) const override {
+        return albedo->value(record.u, record.v, record.point) / (4 * pi);
+    }
 };
 
 #endif //RAY_TRACING_IN_CPP_MATERIAL_H
@@ -5,6 +5,7 @@
 
 #include "util.h"
 #include "Hittable.h"
+#include "light.h"
 
 class Moving_sphere : public Hittable {
 public:
@@ -24,8 +25,19 @@ public:
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &record) const override;
+
     bool bounding_box(double time_0, double time_1, AABB &output_box) const override;
 
+    bool motion_bounds(double time_0, double time_1, AABB &box0, AABB &box1) const override;
+
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override;
+
+    // Lights are sampled where they are at no particular time, so moving emitters are left to scattering.
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.exclude(material_ptr);
+    }
+
     [[nodiscard]] Point3 center(double time) const;
 };
 
@@ -34,6 +46,8 @@ Point3 Moving_sphere::center(double time) const {
 }
 
 bool Moving_sphere::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
+    RT_STAT_PRIMITIVE(Moving_sphere);
+
     Vec3 origin_center = ray.origin() - center(ray.time());
     auto a = ray.direction().length_squared();
     auto half_b = dot(origin_center, ray.direction());
@@ -52,11 +66,30 @@ bool Moving_sphere::hit(const Ray &ray, double t_min, double t_max, Hit_record &
         }
     }
 
-    record.t = root;
-    record.point = ray.at(root);
+    record.set_hit(root, this);
+
+    return true;
+}
+
+void Moving_sphere::finalize_hit(const Ray &ray, Hit_record &record) const {
+    record.point = ray.at(record.t);
     auto outward_normal = (record.point - center(ray.time())) / radius;
     record.set_face_normal(ray, outward_normal);
-    record.material_ptr = material_ptr;
+    record.material_ptr = material_ptr.get();
+}
+
+bool Moving_sphere::boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const {
+    Vec3 origin_center = ray.origin() - center(ray.time());
+    auto a = ray.direction().length_squared();
+    auto half_b = dot(origin_center, ray.direction());
+    auto c = origin_center.length_squared() - radius * radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0) { return false; }
+    auto sqrt_discriminant = sqrt(discriminant);
+
+    t_enter = (-half_b - sqrt_discriminant) / a;
+    t_exit = (-half_b + sqrt_discriminant) / a;
 
     return true;
 }
@@ -71,5 +104,10 @@ bool Moving_sphere::bounding_box(double time_0, double time_1, AABB &output_box)
     output_box = surrounding_box(box0, box1);
     return true;
 }
+bool Moving_sphere::motion_bounds(double time_0, double time_1, AABB &box0, AABB &box1) const {
+    box0 = AABB(center(time_0) - Vec3(radius, radius, radius), center(time_0) + Vec3(radius, radius, radius));
+    box1 = AABB(center(time_1) - Vec3(radius, radius, radius), center(time_1) + Vec3(radius, radius, radius));
+    return true;
+}
 
 #endif //RAY_TRACING_IN_CPP_MOVING_SPHERE_H
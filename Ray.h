@@ -3,27 +3,59 @@
 
 #include "Vec3.h"
 
+// A ray carries what the slab tests need alongside its direction: the reciprocal of each component and whether it is
+// negative (from the sign bit, so -0 counts as negative). Both are derived once, when the direction is set, instead of
+// in every box test; change the direction through set_direction to keep them current.
 class Ray {
 public:
     Point3 _origin;
     Vec3 _direction;
     double _time = 0.0;
+    Vec3 _inverse_direction;
+    int _sign[3] = {0, 0, 0};
 
     Ray() = default;
 
-    Ray(const Point3 &origin, const Vec3 &direction, double time = 0.0) :
-            _origin(origin), _direction(direction), _time(time) {}
+    Ray(const Point3 &origin, const Vec3 &direction, double time = 0.0) : _origin(origin), _time(time) {
+        set_direction(direction);
+    }
 
-    [[nodiscard]] Point3 origin() const { return _origin; }
+    [[nodiscard]] const Point3 &origin() const { return _origin; }
 
-    [[nodiscard]] Vec3 direction() const { return _direction; }
+    [[nodiscard]] const Vec3 &direction() const { return _direction; }
 
     [[nodiscard]] double time() const { return _time; }
 
+    [[nodiscard]] const Vec3 &inverse_direction() const { return _inverse_direction; }
+
+    // 1 where the direction points down the axis.
+    [[nodiscard]] int sign(int axis) const { return _sign[axis]; }
+
     [[nodiscard]] Point3 at(double t) const {
         return _origin + t * _direction;
     }
+
+    // Moving the origin keeps the cached direction data.
+    void set_origin(const Point3 &origin) { _origin = origin; }
+
+    void set_direction(const Vec3 &direction) {
+        _direction = direction;
+        for (int a = 0; a < 3; ++a) {
+            _inverse_direction[a] = 1.0 / direction[a];
+            _sign[a] = std::signbit(direction[a]) ? 1 : 0;
+        }
+    }
 };
 
+// Rays through the neighbouring pixels, one pixel over in x and in y, that follow a camera ray through specular
+// bounces so the width of a pixel can be estimated where it lands (see Hit_record::footprint). Diffuse scattering
+// spreads a pixel over the whole hemisphere, which ends the chain.
+struct Ray_differential {
+    bool valid = false;
+    Point3 x_origin;
+    Vec3 x_direction;
+    Point3 y_origin;
+    Vec3 y_direction;
+};
 
 #endif //RAY_TRACING_IN_CPP_RAY_H
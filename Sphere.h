@@ -4,6 +4,7 @@
 #include <utility>
 
 #include "Hittable.h"
+#include "light.h"
 #include "Vec3.h"
 
 class Sphere : public Hittable {
@@ -19,9 +20,16 @@ public:
 
     bool hit(const Ray &r, double t_min, double t_max, Hit_record &record) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &record) const override;
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override;
 
-private:
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override;
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.add_sphere(_center + offset, _radius, _material_ptr, sampleable);
+    }
+
     static void get_sphere_uv(const Point3 &point, double &u, double &v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -39,6 +47,8 @@ private:
 };
 
 bool Sphere::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
+    RT_STAT_PRIMITIVE(Sphere);
+
     Vec3 origin_center = ray.origin() - _center;
 
     auto a = ray.direction().length_squared();
@@ -58,12 +68,32 @@ bool Sphere::hit(const Ray &ray, double t_min, double t_max, Hit_record &record)
         }
     }
 
-    record.t = root;
-    record.point = ray.at(root);
+    record.set_hit(root, this);
+
+    return true;
+}
+
+void Sphere::finalize_hit(const Ray &ray, Hit_record &record) const {
+    record.point = ray.at(record.t);
     Vec3 outward_normal = (record.point - _center) / _radius;
     record.set_face_normal(ray, outward_normal);
     get_sphere_uv(outward_normal, record.u, record.v);
-    record.material_ptr = _material_ptr;
+    record.material_ptr = _material_ptr.get();
+}
+
+bool Sphere::boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const {
+    Vec3 origin_center = ray.origin() - _center;
+
+    auto a = ray.direction().length_squared();
+    auto half_b = dot(origin_center, ray.direction());
+    auto c = origin_center.length_squared() - _radius * _radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0) { return false; }
+    auto sqrt_discriminant = sqrt(discriminant);
+
+    t_enter = (-half_b - sqrt_discriminant) / a;
+    t_exit = (-half_b + sqrt_discriminant) / a;
 
     return true;
 }
@@ -1,8 +1,11 @@
 #ifndef RAY_TRACING_IN_CPP_TEXTURE_H
 #define RAY_TRACING_IN_CPP_TEXTURE_H
 
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <utility>
+#include <vector>
 
 #include "util.h"
 #include "rtw_stb_image.h"
@@ -13,6 +16,15 @@ class Texture {
 public:
     [[nodiscard]] virtual Color value(double u, double v, const Point3 &point) const = 0;
 
+    // The value without detail finer than footprint, the width of a pixel at the point (0 when unknown). Only
+    // textures that would alias need to filter.
+    [[nodiscard]] virtual Color filtered_value(double u, double v, const Point3 &point, double footprint) const {
+        return value(u, v, point);
+    }
+
+    // Whether the value depends on nothing but the point and the footprint, so that Texture_cache may share it.
+    [[nodiscard]] virtual bool cacheable() const { return false; }
+
     virtual ~Texture() = default;
 };
 
@@ -25,9 +37,12 @@ public:
     Solid_color(double red, double green, double blue) : Solid_color(Color(red, green, blue)) {}
 
     [[nodiscard]] Color value(double u, double v, const Point3 &point) const override {
+        RT_STAT_TEXTURE(Solid_color);
         return color_value;
     }
 
+    [[nodiscard]] bool cacheable() const override { return true; }
+
 private:
     Color color_value;
 };
@@ -46,12 +61,19 @@ public:
                                                odd(std::make_shared<Solid_color>(_odd)) {}
 
     [[nodiscard]] Color value(double u, double v, const Point3 &point) const override {
+        return filtered_value(u, v, point, 0);
+    }
+
+    [[nodiscard]] Color filtered_value(double u, double v, const Point3 &point, double footprint) const override {
+        RT_STAT_TEXTURE(Checker_texture);
 
         if (auto sines = sin(10 * point.x()) * sin(10 * point.y()) * sin(10 * point.z()); sines < 0) {
-            return odd->value(u, v, point);
+            return odd->filtered_value(u, v, point, footprint);
         }
-        return even->value(u, v, point);
+        return even->filtered_value(u, v, point, footprint);
     }
+
+    [[nodiscard]] bool cacheable() const override { return even->cacheable() && odd->cacheable(); }
 };
 
 class Noise_texture : public Texture {
@@ -65,8 +87,17 @@ public:
 
 
     [[nodiscard]] Color value(double u, double v, const Point3 &point) const override {
-        return Color(1, 1, 1) * 0.5 * (1 + sin(scale * point.z() + 10 * noise.turbulence(scale * point)));
+        return filtered_value(u, v, point, 0);
+    }
+
+    // Turbulence octaves finer than the footprint are left out.
+    [[nodiscard]] Color filtered_value(double u, double v, const Point3 &point, double footprint) const override {
+        RT_STAT_TEXTURE(Noise_texture);
+        return Color(1, 1, 1) * 0.5 *
+               (1 + sin(scale * point.z() + 10 * noise.filtered_turbulence(scale * point, scale * footprint)));
     }
+
+    [[nodiscard]] bool cacheable() const override { return true; }
 };
 
 class Image_texture : public Texture {
@@ -100,6 +131,8 @@ public:
     }
 
     [[nodiscard]] Color value(double u, double v, const Vec3 &p) const override {
+        RT_STAT_TEXTURE(Image_texture);
+
         // If we have no texture data, then return solid cyan as a debugging aid.
         if (data == nullptr)
             return {0, 1, 1};
@@ -123,4 +156,77 @@ public:
 
 };
 
+// Texture values at hits with a footprint (primary hits, mostly), shared by the samples of a pixel that land close
+// together instead of evaluated for each. A hit is snapped to a cell between an eighth and a quarter of its footprint
+// wide (a power of two) and the texture is evaluated at the cell's center, with the middle footprint of the hit's
+// quarter octave, so the value only depends on the cell and the bucket.
+// Entries are direct mapped into a fixed table that stays small however large the tile. Render threads keep one each
+// (see texture_cache) and reset it at every tile, which also drops everything from the previous frame.
+class Texture_cache {
+public:
+    bool enabled = false;
+
+    void reset(bool _enabled) {
+        enabled = _enabled;
+        ++generation;
+    }
+
+    Color value(const Texture &texture, double u, double v, const Point3 &point, double footprint);
+
+private:
+    static const int entry_count = 1024;
+
+    struct Entry {
+        const Texture *texture = nullptr;
+        std::int64_t cell[3] = {0, 0, 0};
+        int level = 0;
+        std::uint32_t generation = 0;
+        Color value;
+    };
+
+    std::vector<Entry> entries = std::vector<Entry>(entry_count);
+    std::uint32_t generation = 1;
+};
+
+Color Texture_cache::value(const Texture &texture, double u, double v, const Point3 &point, double footprint) {
+    if (!enabled || !(footprint > 0) || !texture.cacheable()) { return texture.filtered_value(u, v, point, footprint); }
+
+    // Footprints are bucketed by quarter octaves and evaluated at the bucket's middle, so the filter's level of detail
+    // stays within an eighth of an octave of the hit's own. Cells are 2^(e - 2), e being the footprint's binary
+    // exponent.
+    auto level = static_cast<int>(std::floor(4 * std::log2(footprint)));
+    auto cell_size = std::ldexp(1.0, static_cast<int>(std::floor(level / 4.0)) - 2);
+    std::int64_t cell[3];
+    Point3 center;
+    for (int a = 0; a < 3; ++a) {
+        auto scaled = std::floor(point[a] / cell_size);
+        if (std::abs(scaled) > 1e15) { return texture.filtered_value(u, v, point, footprint); }
+        cell[a] = static_cast<std::int64_t>(scaled);
+        center[a] = (scaled + 0.5) * cell_size;
+    }
+
+    auto hash = static_cast<std::uint64_t>(cell[0]) * 73856093u ^ static_cast<std::uint64_t>(cell[1]) * 19349663u ^
+                static_cast<std::uint64_t>(cell[2]) * 83492791u ^ static_cast<std::uint64_t>(level) * 2654435761u ^
+                reinterpret_cast<std::uintptr_t>(&texture) >> 4;
+    auto &entry = entries[(hash ^ hash >> 17) % entry_count];
+
+    if (entry.generation != generation || entry.texture != &texture || entry.level != level ||
+        entry.cell[0] != cell[0] || entry.cell[1] != cell[1] || entry.cell[2] != cell[2]) {
+        entry.texture = &texture;
+        entry.cell[0] = cell[0];
+        entry.cell[1] = cell[1];
+        entry.cell[2] = cell[2];
+        entry.level = level;
+        entry.generation = generation;
+        entry.value = texture.filtered_value(u, v, center, std::exp2((level + 0.5) / 4));
+    }
+    return entry.value;
+}
+
+// The calling thread's texture cache.
+inline Texture_cache &texture_cache() {
+    thread_local Texture_cache cache;
+    return cache;
+}
+
 #endif //RAY_TRACING_IN_CPP_TEXTURE_H
@@ -168,4 +168,11 @@ inline Vec3 refract(const Vec3 &uv, const Vec3 &n, double eta_over_eta_prime) {
     return r_out_perpendicular + r_out_parallel;
 }
 
+// The point of the unit sphere that Sphere::get_sphere_uv maps to (u, v).
+inline Vec3 unit_sphere_point(double u, double v) {
+    auto theta = v * pi;
+    auto phi = 2 * pi * u - pi;
+    return {std::cos(phi) * std::sin(theta), -std::cos(theta), -std::sin(phi) * std::sin(theta)};
+}
+
 #endif //RAY_TRACING_IN_CPP_VEC3_H
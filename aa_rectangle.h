@@ -4,6 +4,7 @@
 #include "util.h"
 
 #include "Hittable.h"
+#include "light.h"
 
 class xy_rectangle : public Hittable {
 public:
@@ -21,11 +22,21 @@ public:
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &record) const override {
+        record.set_face_normal(ray, Vec3(0, 0, 1));
+        record.material_ptr = material.get();
+        record.point = ray.at(record.t);
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Z dimension a small amount.
         output_box = AABB(Point3(x0, y0, k - 0.0001), Point3(x1, y1, k + 0.0001));
         return true;
     }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.add_rectangle(Point3(x0, y0, k) + offset, Vec3(x1 - x0, 0, 0), Vec3(0, y1 - y0, 0), material, sampleable);
+    }
 };
 
 class xz_rectangle : public Hittable {
@@ -44,11 +55,21 @@ public:
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &record) const override {
+        record.set_face_normal(ray, Vec3(0, 1, 0));
+        record.material_ptr = material.get();
+        record.point = ray.at(record.t);
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Z dimension a small amount.
         output_box = AABB(Point3(x0, k - 0.0001, z0), Point3(x1, k + 0.0001, z1));
         return true;
     }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.add_rectangle(Point3(x0, k, z0) + offset, Vec3(x1 - x0, 0, 0), Vec3(0, 0, z1 - z0), material, sampleable);
+    }
 };
 
 class yz_rectangle : public Hittable {
@@ -67,14 +88,26 @@ public:
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &record) const override {
+        record.set_face_normal(ray, Vec3(1, 0, 0));
+        record.material_ptr = material.get();
+        record.point = ray.at(record.t);
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override {
         // The bounding box must have non-zero width in each dimension, so pad the Z dimension a small amount.
         output_box = AABB(Point3(k - 0.0001, y0, z0), Point3(k + 0.0001, y1, z1));
         return true;
     }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.add_rectangle(Point3(k, y0, z0) + offset, Vec3(0, y1 - y0, 0), Vec3(0, 0, z1 - z0), material, sampleable);
+    }
 };
 
 bool xy_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
+    RT_STAT_PRIMITIVE(xy_rectangle);
+
     auto t = (k - ray.origin().z()) / ray.direction().z();
     if (t < t_min || t > t_max) { return false; }
 
@@ -84,17 +117,14 @@ bool xy_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &r
 
     record.u = (x - x0) / (x1 - x0);
     record.v = (y - y0) / (y1 - y0);
-    record.t = t;
-
-    auto outward_normal = Vec3(0, 0, 1);
-    record.set_face_normal(ray, outward_normal);
-    record.material_ptr = material;
-    record.point = ray.at(t);
+    record.set_hit(t, this);
 
     return true;
 }
 
 bool xz_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
+    RT_STAT_PRIMITIVE(xz_rectangle);
+
     auto t = (k - ray.origin().y()) / ray.direction().y();
     if (t < t_min || t > t_max) { return false; }
 
@@ -104,17 +134,14 @@ bool xz_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &r
 
     record.u = (x - x0) / (x1 - x0);
     record.v = (z - z0) / (z1 - z0);
-    record.t = t;
-
-    auto outward_normal = Vec3(0, 1, 0);
-    record.set_face_normal(ray, outward_normal);
-    record.material_ptr = material;
-    record.point = ray.at(t);
+    record.set_hit(t, this);
 
     return true;
 }
 
 bool yz_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
+    RT_STAT_PRIMITIVE(yz_rectangle);
+
     auto t = (k - ray.origin().x()) / ray.direction().x();
     if (t < t_min || t > t_max) { return false; }
 
@@ -124,12 +151,7 @@ bool yz_rectangle::hit(const Ray &ray, double t_min, double t_max, Hit_record &r
 
     record.u = (y - y0) / (y1 - y0);
     record.v = (z - z0) / (z1 - z0);
-    record.t = t;
-
-    auto outward_normal = Vec3(1, 0, 0);
-    record.set_face_normal(ray, outward_normal);
-    record.material_ptr = material;
-    record.point = ray.at(t);
+    record.set_hit(t, this);
 
     return true;
 }
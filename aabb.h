@@ -1,8 +1,86 @@
 #ifndef RAY_TRACING_IN_CPP_AABB_H
 #define RAY_TRACING_IN_CPP_AABB_H
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "util.h"
 
+// max and min as maxsd and minsd compute them: the second operand when the first is NaN.
+inline double slab_max(double a, double b) { return a > b ? a : b; }
+
+inline double slab_min(double a, double b) { return a < b ? a : b; }
+
+// Slab test of the box [box_min, box_max]: narrows [t_min, t_max] to the part of the ray inside the box and tells
+// whether any of it is left. It is branchless; the entry and exit planes of each slab come from the ray's direction
+// signs rather than from comparing the two distances. A ray lying in a face plane gives 0 * inf = NaN for that plane,
+// always as the first operand of slab_max/slab_min, so it drops out and the ray counts as inside that slab.
+inline bool slab_test(const Point3 &box_min, const Point3 &box_max, const Ray &ray, double &t_min, double &t_max) {
+    const Point3 *planes[2] = {&box_min, &box_max};
+    const auto &inverse_direction = ray.inverse_direction();
+
+    for (int a = 0; a < 3; a++) {
+        auto t0 = ((*planes[ray.sign(a)])[a] - ray._origin[a]) * inverse_direction[a];
+        auto t1 = ((*planes[1 - ray.sign(a)])[a] - ray._origin[a]) * inverse_direction[a];
+        t_min = slab_max(t0, t_min);
+        t_max = slab_min(t1, t_max);
+    }
+
+    return t_min < t_max;
+}
+
+const int slab_lane_count = 4;
+
+// slab_test of one ray against four boxes stored as structure of arrays: lane i spans lane_min[a][i] to
+// lane_max[a][i] on axis a. Leaves each lane's interval, clipped to [t_min, t_max], in t_near and t_far; a lane is
+// hit when t_near < t_far. Uses AVX or two SSE2 halves when the build has them, with the same NaN handling.
+inline void slab_test_4(const double *const lane_min[3], const double *const lane_max[3], const Ray &ray,
+                        double t_min, double t_max, double t_near[slab_lane_count], double t_far[slab_lane_count]) {
+    const auto &inverse_direction = ray.inverse_direction();
+
+#if defined(__AVX__)
+    auto near = _mm256_set1_pd(t_min);
+    auto far = _mm256_set1_pd(t_max);
+    for (int a = 0; a < 3; a++) {
+        const auto *near_planes = ray.sign(a) ? lane_max[a] : lane_min[a];
+        const auto *far_planes = ray.sign(a) ? lane_min[a] : lane_max[a];
+        auto origin = _mm256_set1_pd(ray._origin[a]);
+        auto inverse = _mm256_set1_pd(inverse_direction[a]);
+        near = _mm256_max_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(near_planes), origin), inverse), near);
+        far = _mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(far_planes), origin), inverse), far);
+    }
+    _mm256_storeu_pd(t_near, near);
+    _mm256_storeu_pd(t_far, far);
+#elif defined(__SSE2__)
+    for (int half = 0; half < slab_lane_count; half += 2) {
+        auto near = _mm_set1_pd(t_min);
+        auto far = _mm_set1_pd(t_max);
+        for (int a = 0; a < 3; a++) {
+            const auto *near_planes = ray.sign(a) ? lane_max[a] : lane_min[a];
+            const auto *far_planes = ray.sign(a) ? lane_min[a] : lane_max[a];
+            auto origin = _mm_set1_pd(ray._origin[a]);
+            auto inverse = _mm_set1_pd(inverse_direction[a]);
+            near = _mm_max_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(near_planes + half), origin), inverse), near);
+            far = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(far_planes + half), origin), inverse), far);
+        }
+        _mm_storeu_pd(t_near + half, near);
+        _mm_storeu_pd(t_far + half, far);
+    }
+#else
+    for (int lane = 0; lane < slab_lane_count; ++lane) {
+        t_near[lane] = t_min;
+        t_far[lane] = t_max;
+        for (int a = 0; a < 3; a++) {
+            const auto *near_planes = ray.sign(a) ? lane_max[a] : lane_min[a];
+            const auto *far_planes = ray.sign(a) ? lane_min[a] : lane_max[a];
+            t_near[lane] = slab_max((near_planes[lane] - ray._origin[a]) * inverse_direction[a], t_near[lane]);
+            t_far[lane] = slab_min((far_planes[lane] - ray._origin[a]) * inverse_direction[a], t_far[lane]);
+        }
+    }
+#endif
+}
+
 class Axis_Aligned_Bounding_Box {
 public:
     Point3 minimum;
@@ -16,29 +94,36 @@ public:
 
     [[nodiscard]] Point3 max() const { return maximum; }
 
-    [[nodiscard]] bool hit(const Ray &ray, double t_min, double t_max) const {
-        for (int a = 0; a < 3; a++) {
-            auto inverse_direction = 1.0 / ray.direction()[a];
+    [[nodiscard]] double surface_area() const {
+        auto extent = maximum - minimum;
+        return 2 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+    }
 
-            auto t0 = (min()[a] - ray.origin()[a]) * inverse_direction;
-            auto t1 = (max()[a] - ray.origin()[a]) * inverse_direction;
+    [[nodiscard]] bool hit(const Ray &ray, double t_min, double t_max) const {
+        RT_STAT_BOX_TEST();
+        return slab_test(minimum, maximum, ray, t_min, t_max);
+    }
+};
 
-            if (inverse_direction < 0.0) { std::swap(t0, t1); }
+using AABB = Axis_Aligned_Bounding_Box;
 
-            t_min = t0 > t_min ? t0 : t_min;
-            t_max = t1 < t_max ? t1 : t_max;
+inline bool operator==(const AABB &box0, const AABB &box1) {
+    return box0.minimum.coordinates == box1.minimum.coordinates && box0.maximum.coordinates == box1.maximum.coordinates;
+}
 
-            if (t_max <= t_min) {
-                return false;
-            }
-        }
+// Slab test against the box blended linearly from box0 to box1 by blend in [0, 1].
+inline bool hit_blended(const AABB &box0, const AABB &box1, double blend, const Ray &ray, double t_min, double t_max) {
+    RT_STAT_BOX_TEST();
 
-        return true;
+    Point3 low;
+    Point3 high;
+    for (int a = 0; a < 3; a++) {
+        low[a] = box0.minimum[a] + blend * (box1.minimum[a] - box0.minimum[a]);
+        high[a] = box0.maximum[a] + blend * (box1.maximum[a] - box0.maximum[a]);
     }
 
-};
-
-using AABB = Axis_Aligned_Bounding_Box;
+    return slab_test(low, high, ray, t_min, t_max);
+}
 
 inline AABB surrounding_box(const AABB &box0, const AABB &box1) {
     Point3 small(fmin(box0.min().x(), box1.min().x()),
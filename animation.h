@@ -0,0 +1,133 @@
+#ifndef RAY_TRACING_IN_CPP_ANIMATION_H
+#define RAY_TRACING_IN_CPP_ANIMATION_H
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "util.h"
+
+#include "bvh.h"
+#include "render.h"
+
+// An animation of frame_count frames spanning scene time 0 to 1, of which frames first_frame to last_frame are
+// rendered. Frame f opens its shutter at f / frame_count and closes it when the next frame starts, so moving objects
+// travel over the sequence the way they blur within a single image, and the camera circles its target by
+// turntable_degrees over the whole sequence.
+struct Sequence {
+    int first_frame = 0;
+    int last_frame = 0;
+    int frame_count = 240;
+    double turntable_degrees = 0;
+    double rebuild_threshold = 2;               // see Frame_world
+    std::string output_pattern = "frame_%04d.ppm";
+    Image_format format = Image_format::ppm_text;
+    Post_process post;
+};
+
+// Moves the scene's world to a frame's shutter interval. Its bounds are refit every frame, and a top-level BVH is
+// rebuilt once refitting has grown its nodes by more than rebuild_threshold on average (see BVH_node::area_growth),
+// since the tree's grouping then no longer matches where the objects are.
+class Frame_world {
+public:
+    int refits = 0;
+    int rebuilds = 0;
+
+    Frame_world(Scene &_scene, double _rebuild_threshold) : scene(_scene), rebuild_threshold(_rebuild_threshold) {}
+
+    // Returns true when the BVH was rebuilt rather than refit.
+    bool advance(double time0, double time1);
+
+    [[nodiscard]] double area_growth() const {
+        const auto *bvh = dynamic_cast<const BVH_node *>(scene.world.get());
+        return bvh != nullptr ? bvh->area_growth() : 1.0;
+    }
+
+private:
+    Scene &scene;
+    double rebuild_threshold;
+    bool first_frame = true;
+};
+
+bool Frame_world::advance(double time0, double time1) {
+    auto *bvh = dynamic_cast<BVH_node *>(scene.world.get());
+
+    // The first frame's tree is built for its own interval instead of the whole sequence.
+    if (bvh != nullptr && first_frame) {
+        first_frame = false;
+        bvh->rebuild(time0, time1);
+        return true;
+    }
+
+    {
+        RT_TRACE_SCOPE("bvh_refit");
+        scene.world->refit(time0, time1);
+    }
+    ++refits;
+
+    if (bvh == nullptr || bvh->area_growth() <= rebuild_threshold) { return false; }
+
+    bvh->rebuild(time0, time1);
+    ++rebuilds;
+    return true;
+}
+
+// True when pattern holds exactly one frame number, as %d or %0Nd with N below 100, and no other % but %%.
+inline bool valid_frame_pattern(const std::string &pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') { continue; }
+        if (++i < pattern.size() && pattern[i] == '%') { continue; }
+
+        if (i < pattern.size() && pattern[i] == '0') {
+            auto width_start = ++i;
+            while (i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i]))) { ++i; }
+            if (i == width_start || i - width_start > 2) { return false; }
+        }
+        if (i >= pattern.size() || pattern[i] != 'd') { return false; }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+// The file name of a frame from a pattern valid_frame_pattern accepts.
+inline std::string frame_path(const std::string &pattern, int frame) {
+    auto size = std::snprintf(nullptr, 0, pattern.c_str(), frame);
+    std::string path(size, '\0');
+    std::snprintf(path.data(), path.size() + 1, pattern.c_str(), frame);
+    return path;
+}
+
+// Render the frames of a sequence, each to its own image file. The scene with its textures and materials is built once;
+// only the camera and the world's bounds change between frames.
+bool render_sequence(const Sequence &sequence, const Image &image, Scene &scene) {
+    const auto base_camera = scene.camera;
+    Frame_world world(scene, sequence.rebuild_threshold);
+
+    for (int frame = sequence.first_frame; frame <= sequence.last_frame; ++frame) {
+        RT_TRACE_SCOPE("frame", frame);
+        auto start = std::chrono::steady_clock::now();
+
+        auto time0 = double(frame) / sequence.frame_count;
+        auto time1 = double(frame + 1) / sequence.frame_count;
+        scene.camera = base_camera.orbited(sequence.turntable_degrees * time0, time0, time1);
+        auto rebuilt = world.advance(time0, time1);
+
+        Accumulation_buffer buffer(image);
+        auto rays = render_pass(image, scene, buffer, image.sample_per_pixel);
+
+        auto path = frame_path(sequence.output_pattern, frame);
+        if (!write_image(path, buffer, sequence.format, sequence.post)) { return false; }
+
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "frame " << frame << ": " << path << ", " << seconds << " s, " << rays << " rays, bvh growth "
+                  << world.area_growth() << (rebuilt ? " (rebuilt)" : "") << '\n';
+    }
+
+    std::cerr << "sequence: " << world.refits << " refits, " << world.rebuilds << " rebuilds\n";
+    return true;
+}
+
+#endif //RAY_TRACING_IN_CPP_ANIMATION_H
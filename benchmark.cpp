@@ -0,0 +1,622 @@
+#include "util.h"
+
+#include "box.h"
+#include "render.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Renders the canonical scenes at fixed settings and reports timings as JSON or CSV, so runs can be diffed between
+// commits. Each case runs in its own forked process so that its peak RSS is not polluted by earlier cases. Renders
+// go through render_pass into an Accumulation_buffer, the path ray_tracing_in_cpp uses. Sampled environment map
+// directions are checked against lookups first; a disagreement fails the run.
+//
+// With --slab-boxes N it instead checks the slab kernels on degenerate rays and times each of them on N random boxes,
+// reporting box tests per second.
+//
+// Usage: ray_tracing_benchmark [--format json|csv] [--output FILE] [--repeat N] [--width W] [--spp N]
+//                              [--depth N] [--seed N] [--threads N] [--spheres N] [--scenes ID,ID,...]
+//                              [--light-sampling on|off] [--texture-cache on|off] [--slab-boxes N]
+
+struct Benchmark_settings {
+    std::string format = "json";
+    std::string output;
+    int repeat = 3;
+    int width = 160;
+    int sample_per_pixel = 4;
+    int max_depth = 50;
+    unsigned int seed = 0;
+    unsigned int thread_count = 0;      // see Image
+    int sphere_count = 100000;
+    bool light_sampling = true;
+    bool texture_cache = true;
+    std::vector<int> scene_ids = {1, 2, 3, 4, 5, 6, 7, 8, 9, 0};
+    int slab_box_count = 0;             // 0 benchmarks the scenes
+};
+
+struct Benchmark_case {
+    std::string name;
+    int scene_id = 0;   // choose_scene id; 0 is the synthetic sphere stress scene
+};
+
+// Written by the child process through a pipe, so it must stay trivially copyable.
+struct Benchmark_measurement {
+    bool ok = false;
+    int width = 0;
+    int height = 0;
+    int sample_per_pixel = 0;
+    double scene_build_seconds = 0.0;
+    double bvh_build_seconds = 0.0;
+    double render_min_seconds = 0.0;
+    double render_median_seconds = 0.0;
+    double render_mean_seconds = 0.0;
+    unsigned long long rays = 0;
+    long peak_rss_kb = 0;
+};
+
+// Name of a benchmark scene, empty for an unknown id.
+std::string scene_name(int id, const Benchmark_settings &settings) {
+    switch (id) {
+        case 1:
+            return "random_scene";
+        case 2:
+            return "two_spheres";
+        case 3:
+            return "two_perlin_spheres";
+        case 4:
+            return "earth";
+        case 5:
+            return "simple_light";
+        case 6:
+            return "cornell_box";
+        case 7:
+            return "cornell_smoke";
+        case 8:
+            return "final_scene";
+        case 9:
+            return "cornell_noise_smoke";
+        case 0:
+            return "many_spheres_" + std::to_string(settings.sphere_count);
+        default:
+            return "";
+    }
+}
+
+Scene build_benchmark_scene(const Benchmark_case &benchmark_case, const Benchmark_settings &settings, Image &image) {
+    if (benchmark_case.scene_id != 0) {
+        return choose_scene(benchmark_case.scene_id, image);
+    }
+
+    Scene scene;
+    image.aspect_ratio = 16. / 9.;
+
+    auto objects = many_spheres(settings.sphere_count);
+
+    auto bvh_start = std::chrono::steady_clock::now();
+    scene.world = std::make_unique<BVH_node>(objects, 0, 1);
+    scene.bvh_build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+
+    scene.background = Color(0.70, 0.80, 1.00);
+    scene.camera = Camera(Point3(0, 12, 45), Point3(0, 10, 0), Vec3(0, 1, 0), 40, image.aspect_ratio, 0., 45., 0, 1);
+
+    return scene;
+}
+
+Benchmark_measurement run_case(const Benchmark_case &benchmark_case, const Benchmark_settings &settings) {
+    Benchmark_measurement measurement;
+
+    Image image;
+    image.max_depth = settings.max_depth;
+    image.seed = settings.seed;
+    image.thread_count = settings.thread_count;
+    image.cache_textures = settings.texture_cache;
+
+    seed_random(settings.seed);
+    auto build_start = std::chrono::steady_clock::now();
+    Scene scene = build_benchmark_scene(benchmark_case, settings, image);
+    if (settings.light_sampling) { build_lights(scene); }
+    measurement.scene_build_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+    measurement.bvh_build_seconds = scene.bvh_build_seconds;
+
+    // Scenes pick their own resolution and sample count; the benchmark overrides them for comparable runs.
+    image.set_width(settings.width);
+    image.sample_per_pixel = settings.sample_per_pixel;
+
+    // Progress on a terminal only, completing the line the parent process started.
+    auto show_progress = isatty(STDERR_FILENO) != 0;
+
+    std::vector<double> render_seconds;
+    for (int run = 0; run < settings.repeat; ++run) {
+        reset_render_stats();
+        Accumulation_buffer buffer(image);
+
+        auto render_start = std::chrono::steady_clock::now();
+        auto rays = render_pass(image, scene, buffer, image.sample_per_pixel, [&]() {
+            if (!show_progress) { return; }
+            std::cerr << "\rbenchmark: " << benchmark_case.name << "... run " << run + 1 << '/' << settings.repeat
+                      << ' ' << 100 * buffer.finished_bands() / buffer.band_count() << '%' << std::flush;
+        });
+        render_seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count());
+
+        measurement.rays = rays;
+    }
+
+    // Counters from the last run only, on stderr so the JSON/CSV output stays machine-readable.
+    if (render_stats_enabled) {
+        std::cerr << '\n' << benchmark_case.name << ": ";
+        print_render_stats(std::cerr, merge_render_stats());
+    }
+
+    std::sort(render_seconds.begin(), render_seconds.end());
+    measurement.render_min_seconds = render_seconds.front();
+    measurement.render_median_seconds = render_seconds[render_seconds.size() / 2];
+    for (auto seconds: render_seconds) {
+        measurement.render_mean_seconds += seconds / static_cast<double>(render_seconds.size());
+    }
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    measurement.peak_rss_kb = usage.ru_maxrss;
+
+    measurement.width = image.width;
+    measurement.height = image.height;
+    measurement.sample_per_pixel = image.sample_per_pixel;
+    measurement.ok = true;
+
+    return measurement;
+}
+
+Benchmark_measurement run_case_isolated(const Benchmark_case &benchmark_case, const Benchmark_settings &settings) {
+    Benchmark_measurement measurement;
+
+    int channel[2];
+    if (pipe(channel) != 0) {
+        std::cerr << "ERROR: pipe failed, running '" << benchmark_case.name << "' in process.\n";
+        return run_case(benchmark_case, settings);
+    }
+
+    auto child = fork();
+    if (child == 0) {
+        close(channel[0]);
+        auto result = run_case(benchmark_case, settings);
+        auto written = write(channel[1], &result, sizeof(result));
+        close(channel[1]);
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+
+    close(channel[1]);
+    if (child > 0) {
+        if (read(channel[0], &measurement, sizeof(measurement)) != sizeof(measurement)) {
+            measurement.ok = false;
+        }
+        waitpid(child, nullptr, 0);
+    }
+    close(channel[0]);
+
+    return measurement;
+}
+
+double rays_per_second(const Benchmark_measurement &measurement) {
+    return measurement.render_median_seconds > 0 ? double(measurement.rays) / measurement.render_median_seconds : 0;
+}
+
+void write_csv(std::ostream &out, const Benchmark_settings &settings, const std::vector<Benchmark_case> &cases,
+               const std::vector<Benchmark_measurement> &measurements) {
+    out << "scene,ok,width,height,spp,max_depth,seed,repeat,scene_build_s,bvh_build_s,"
+           "render_min_s,render_median_s,render_mean_s,rays,rays_per_s,peak_rss_kb\n";
+
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const auto &m = measurements[i];
+        out << cases[i].name << ',' << (m.ok ? 1 : 0) << ',' << m.width << ',' << m.height << ','
+            << m.sample_per_pixel << ',' << settings.max_depth << ',' << settings.seed << ',' << settings.repeat << ','
+            << m.scene_build_seconds << ',' << m.bvh_build_seconds << ',' << m.render_min_seconds << ','
+            << m.render_median_seconds << ',' << m.render_mean_seconds << ',' << m.rays << ','
+            << rays_per_second(m) << ',' << m.peak_rss_kb << '\n';
+    }
+}
+
+void write_json(std::ostream &out, const Benchmark_settings &settings, const std::vector<Benchmark_case> &cases,
+                const std::vector<Benchmark_measurement> &measurements) {
+    Image image;
+    image.thread_count = settings.thread_count;
+
+    out << "{\n"
+        << "  \"settings\": {\"width\": " << settings.width << ", \"spp\": " << settings.sample_per_pixel
+        << ", \"max_depth\": " << settings.max_depth << ", \"seed\": " << settings.seed
+        << ", \"repeat\": " << settings.repeat << ", \"threads\": " << image.threads() << "},\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const auto &m = measurements[i];
+        out << "    {\"scene\": \"" << cases[i].name << "\", \"ok\": " << (m.ok ? "true" : "false")
+            << ", \"width\": " << m.width << ", \"height\": " << m.height << ", \"spp\": " << m.sample_per_pixel
+            << ", \"scene_build_s\": " << m.scene_build_seconds << ", \"bvh_build_s\": " << m.bvh_build_seconds
+            << ", \"render_min_s\": " << m.render_min_seconds << ", \"render_median_s\": " << m.render_median_seconds
+            << ", \"render_mean_s\": " << m.render_mean_seconds << ", \"rays\": " << m.rays
+            << ", \"rays_per_s\": " << rays_per_second(m) << ", \"peak_rss_kb\": " << m.peak_rss_kb << '}'
+            << (i + 1 < cases.size() ? "," : "") << '\n';
+    }
+
+    out << "  ]\n}\n";
+}
+
+// The slab test as AABB::hit did it before rays cached their reciprocal direction: the baseline for the slab kernels,
+// and the reference they must agree with on ordinary rays.
+bool reference_slab_test(const AABB &box, const Ray &ray, double t_min, double t_max) {
+    for (int a = 0; a < 3; a++) {
+        auto inverse_direction = 1.0 / ray.direction()[a];
+        auto t0 = (box.minimum[a] - ray.origin()[a]) * inverse_direction;
+        auto t1 = (box.maximum[a] - ray.origin()[a]) * inverse_direction;
+        if (inverse_direction < 0.0) { std::swap(t0, t1); }
+
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max <= t_min) { return false; }
+    }
+    return true;
+}
+
+// Sampled environment directions against lookups: every sample of maps holding one bright texel among dim ones must
+// see the radiance it was weighted with. False after printing the first disagreement of each map.
+bool run_environment_checks() {
+    const int width = 16;
+    const int height = 8;
+    const int texels[][2] = {{0, 0}, {2, 3}, {4, 12}, {7, 15}};
+
+    bool ok = true;
+    for (const auto &texel: texels) {
+        std::vector<float> rgb(3 * width * height, 0.01f);
+        for (int c = 0; c < 3; ++c) { rgb[3 * (texel[0] * width + texel[1]) + c] = 100.0f; }
+        Environment_map map;
+        map.build(rgb.data(), width, height, 1.0);
+
+        for (int i = 0; i < 10000; ++i) {
+            Vec3 direction;
+            Color value;
+            double pdf;
+            if (!map.sample(direction, value, pdf)) { continue; }
+
+            auto seen = map.radiance(direction);
+            if (seen.x() != value.x() || seen.y() != value.y() || seen.z() != value.z()) {
+                std::cerr << "ERROR: environment sample toward " << direction << " was weighted with " << value.x()
+                          << " but sees " << seen.x() << " (bright texel at row " << texel[0] << ", column "
+                          << texel[1] << ").\n";
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
+
+// A ray at a corner case of the slab test and whether it meets the unit box for t >= 0. Rays lying in a face plane
+// count as inside that slab.
+struct Slab_check {
+    const char *name;
+    Point3 origin;
+    Vec3 direction;
+    bool hit;
+};
+
+// Every slab kernel against the degenerate rays; false after printing each disagreement.
+bool run_slab_checks() {
+    const Slab_check checks[] = {
+            {"axis ray through the box", {0.5, 0.5, -1}, {0, 0, 1}, true},
+            {"axis ray beside the box", {2, 0.5, -1}, {0, 0, 1}, false},
+            {"negative zero components", {0.5, 0.5, 2}, {-0.0, -0.0, -1}, true},
+            {"in the x = 0 plane", {0, 0.5, -1}, {0, 0, 1}, true},
+            {"in the x = 1 plane", {1, 0.5, -1}, {0, 0, 1}, true},
+            {"in the x = 0 plane, -0", {0, 0.5, -1}, {-0.0, 0, 1}, true},
+            {"in the x = 1 plane, -0", {1, 0.5, -1}, {-0.0, 0, 1}, true},
+            {"along an edge", {0, 1, -1}, {0, -0.0, 1}, true},
+            {"in a face plane beside the box", {0, 2, -1}, {0, 0, 1}, false},
+            {"starting inside", {0.5, 0.5, 0.5}, {1, 2, 3}, true},
+            {"pointing away", {0.5, 0.5, 2}, {0, 0, 1}, false},
+            {"diagonal", {-1, -1, -1}, {1, 1, 1}, true},
+    };
+
+    const AABB box(Point3(0, 0, 0), Point3(1, 1, 1));
+    // Blended halfway, these give the unit box exactly.
+    const AABB box0(Point3(-1, -1, -1), Point3(0, 0, 0));
+    const AABB box1(Point3(1, 1, 1), Point3(2, 2, 2));
+    const Box solid_box(box.minimum, box.maximum, nullptr);
+    Box_group group;
+    for (int lane = 0; lane < Box_group::lane_count; ++lane) { group.add(box.minimum, box.maximum, nullptr); }
+
+    const double zeros[slab_lane_count] = {0, 0, 0, 0};
+    const double ones[slab_lane_count] = {1, 1, 1, 1};
+    const double *const lane_min[3] = {zeros, zeros, zeros};
+    const double *const lane_max[3] = {ones, ones, ones};
+
+    bool ok = true;
+    for (const auto &check: checks) {
+        Ray ray(check.origin, check.direction);
+        Hit_record record;
+
+        double t_near[slab_lane_count];
+        double t_far[slab_lane_count];
+        slab_test_4(lane_min, lane_max, ray, 0, infinity, t_near, t_far);
+        bool lanes_hit = true;
+        for (int lane = 0; lane < slab_lane_count; ++lane) { lanes_hit &= t_near[lane] < t_far[lane]; }
+
+        const std::pair<const char *, bool> results[] = {
+                {"AABB::hit", box.hit(ray, 0, infinity)},
+                {"hit_blended", hit_blended(box0, box1, 0.5, ray, 0, infinity)},
+                {"slab_test_4", lanes_hit},
+                {"Box::hit", solid_box.hit(ray, 0, infinity, record)},
+                {"Box_group::hit", group.hit(ray, 0, infinity, record)},
+        };
+        for (const auto &[kernel, hit]: results) {
+            if (hit != check.hit) {
+                std::cerr << "ERROR: slab check '" << check.name << "' failed for " << kernel << ".\n";
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
+
+struct Slab_measurement {
+    std::string kernel;
+    bool ok = false;                    // agreed with reference_slab_test on every box and ray
+    double seconds = 0.0;               // fastest of the repeats
+    unsigned long long tests = 0;
+    unsigned long long hits = 0;
+};
+
+std::vector<Slab_measurement> run_slab_benchmark(const Benchmark_settings &settings) {
+    const int ray_count = 1000;
+    const auto box_count = static_cast<size_t>(settings.slab_box_count);
+    seed_random(settings.seed);
+
+    // Boxes scattered over [-1, 1]^3, also as padded structure of arrays for slab_test_4.
+    std::vector<AABB> boxes;
+    const auto padded_count = (box_count + slab_lane_count - 1) / slab_lane_count * slab_lane_count;
+    std::vector<double> lane_min[3];
+    std::vector<double> lane_max[3];
+    for (int a = 0; a < 3; ++a) {
+        lane_min[a].resize(padded_count, infinity);
+        lane_max[a].resize(padded_count, -infinity);
+    }
+    for (size_t i = 0; i < box_count; ++i) {
+        Point3 low;
+        Point3 high;
+        for (int a = 0; a < 3; ++a) {
+            auto center = random_double(-1, 1);
+            auto half_size = random_double(0.01, 0.2);
+            low[a] = lane_min[a][i] = center - half_size;
+            high[a] = lane_max[a][i] = center + half_size;
+        }
+        boxes.emplace_back(low, high);
+    }
+
+    // Every eighth ray runs along an axis, so the NaN-prone zero components are part of the mix.
+    std::vector<Ray> rays;
+    for (int i = 0; i < ray_count; ++i) {
+        Point3 origin(random_double(-2, 2), random_double(-2, 2), random_double(-2, 2));
+        Vec3 direction = random_unit_vector();
+        if (i % 8 == 0) {
+            direction = Vec3(0, 0, 0);
+            direction[random_int(0, 2)] = random_double() < 0.5 ? -1 : 1;
+        }
+        rays.emplace_back(origin, direction);
+    }
+
+    auto test_lanes = [&](const Ray &ray, size_t base, double t_near[slab_lane_count], double t_far[slab_lane_count]) {
+        const double *const group_min[3] = {&lane_min[0][base], &lane_min[1][base], &lane_min[2][base]};
+        const double *const group_max[3] = {&lane_max[0][base], &lane_max[1][base], &lane_max[2][base]};
+        slab_test_4(group_min, group_max, ray, 0, infinity, t_near, t_far);
+    };
+
+    bool agree = true;
+    for (const auto &ray: rays) {
+        for (size_t base = 0; base < padded_count; base += slab_lane_count) {
+            double t_near[slab_lane_count];
+            double t_far[slab_lane_count];
+            test_lanes(ray, base, t_near, t_far);
+            for (size_t i = base; i < std::min(base + slab_lane_count, box_count); ++i) {
+                auto expected = reference_slab_test(boxes[i], ray, 0, infinity);
+                agree &= boxes[i].hit(ray, 0, infinity) == expected && (t_near[i - base] < t_far[i - base]) == expected;
+            }
+        }
+    }
+    if (!agree) { std::cerr << "ERROR: slab kernels disagree with the reference on random rays.\n"; }
+
+    auto measure = [&](const char *kernel, auto &&count_hits) {
+        Slab_measurement measurement{kernel, agree, infinity, ray_count * box_count};
+        for (int run = 0; run < settings.repeat; ++run) {
+            unsigned long long hits = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (const auto &ray: rays) { hits += count_hits(ray); }
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            measurement.seconds = std::min(measurement.seconds, seconds);
+            measurement.hits = hits;
+        }
+        return measurement;
+    };
+
+    std::vector<Slab_measurement> measurements;
+    measurements.push_back(measure("reference", [&](const Ray &ray) {
+        unsigned long long hits = 0;
+        for (const auto &box: boxes) { hits += reference_slab_test(box, ray, 0, infinity); }
+        return hits;
+    }));
+    measurements.push_back(measure("slab_test", [&](const Ray &ray) {
+        unsigned long long hits = 0;
+        for (const auto &box: boxes) {
+            double t_min = 0;
+            double t_max = infinity;
+            hits += slab_test(box.minimum, box.maximum, ray, t_min, t_max);
+        }
+        return hits;
+    }));
+    measurements.push_back(measure("slab_test_4", [&](const Ray &ray) {
+        unsigned long long hits = 0;
+        for (size_t base = 0; base < padded_count; base += slab_lane_count) {
+            double t_near[slab_lane_count];
+            double t_far[slab_lane_count];
+            test_lanes(ray, base, t_near, t_far);
+            for (int lane = 0; lane < slab_lane_count; ++lane) { hits += t_near[lane] < t_far[lane]; }
+        }
+        return hits;
+    }));
+
+    return measurements;
+}
+
+double boxes_per_second(const Slab_measurement &measurement) {
+    return measurement.seconds > 0 ? double(measurement.tests) / measurement.seconds : 0;
+}
+
+void write_slab_csv(std::ostream &out, const Benchmark_settings &settings,
+                    const std::vector<Slab_measurement> &measurements) {
+    out << "kernel,ok,boxes,repeat,tests,hits,seconds,boxes_per_s\n";
+    for (const auto &m: measurements) {
+        out << m.kernel << ',' << (m.ok ? 1 : 0) << ',' << settings.slab_box_count << ',' << settings.repeat << ','
+            << m.tests << ',' << m.hits << ',' << m.seconds << ',' << boxes_per_second(m) << '\n';
+    }
+}
+
+void write_slab_json(std::ostream &out, const Benchmark_settings &settings,
+                     const std::vector<Slab_measurement> &measurements) {
+    out << "{\n"
+        << "  \"settings\": {\"boxes\": " << settings.slab_box_count << ", \"seed\": " << settings.seed
+        << ", \"repeat\": " << settings.repeat << "},\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < measurements.size(); ++i) {
+        const auto &m = measurements[i];
+        out << "    {\"kernel\": \"" << m.kernel << "\", \"ok\": " << (m.ok ? "true" : "false")
+            << ", \"tests\": " << m.tests << ", \"hits\": " << m.hits << ", \"seconds\": " << m.seconds
+            << ", \"boxes_per_s\": " << boxes_per_second(m) << '}' << (i + 1 < measurements.size() ? "," : "")
+            << '\n';
+    }
+
+    out << "  ]\n}\n";
+}
+
+bool parse_arguments(int argc, char **argv, Benchmark_settings &settings) {
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << argument << '\n';
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (argument == "--format") {
+            settings.format = value;
+        } else if (argument == "--output") {
+            settings.output = value;
+        } else if (argument == "--repeat") {
+            settings.repeat = std::max(1, std::stoi(value));
+        } else if (argument == "--width") {
+            settings.width = std::stoi(value);
+        } else if (argument == "--spp") {
+            settings.sample_per_pixel = std::stoi(value);
+        } else if (argument == "--depth") {
+            settings.max_depth = std::stoi(value);
+        } else if (argument == "--seed") {
+            settings.seed = static_cast<unsigned int>(std::stoul(value));
+        } else if (argument == "--threads") {
+            settings.thread_count = static_cast<unsigned int>(std::stoul(value));
+        } else if (argument == "--spheres") {
+            settings.sphere_count = std::stoi(value);
+        } else if (argument == "--light-sampling") {
+            if (value != "on" && value != "off") {
+                std::cerr << "Invalid value '" << value << "' for " << argument << " (expected on or off)\n";
+                return false;
+            }
+            settings.light_sampling = value == "on";
+        } else if (argument == "--texture-cache") {
+            if (value != "on" && value != "off") {
+                std::cerr << "Invalid value '" << value << "' for " << argument << " (expected on or off)\n";
+                return false;
+            }
+            settings.texture_cache = value == "on";
+        } else if (argument == "--slab-boxes") {
+            settings.slab_box_count = std::max(0, std::stoi(value));
+        } else if (argument == "--scenes") {
+            settings.scene_ids.clear();
+            size_t position = 0;
+            while (position < value.size()) {
+                auto comma = value.find(',', position);
+                if (comma == std::string::npos) { comma = value.size(); }
+                settings.scene_ids.push_back(std::stoi(value.substr(position, comma - position)));
+                position = comma + 1;
+
+                if (scene_name(settings.scene_ids.back(), settings).empty()) {
+                    std::cerr << "Unknown scene " << settings.scene_ids.back() << " (expected 0 to 9)\n";
+                    return false;
+                }
+            }
+        } else {
+            std::cerr << "Unknown option " << argument << '\n';
+            return false;
+        }
+    }
+
+    if (settings.format != "json" && settings.format != "csv") {
+        std::cerr << "Unknown format " << settings.format << " (expected json or csv)\n";
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Benchmark_settings settings;
+    if (!parse_arguments(argc, argv, settings)) { return 1; }
+
+    std::ofstream file;
+    if (!settings.output.empty()) {
+        file.open(settings.output);
+    }
+    std::ostream &out = settings.output.empty() ? std::cout : file;
+
+    if (settings.slab_box_count > 0) {
+        auto checks_ok = run_slab_checks();
+        auto measurements = run_slab_benchmark(settings);
+        if (settings.format == "csv") {
+            write_slab_csv(out, settings, measurements);
+        } else {
+            write_slab_json(out, settings, measurements);
+        }
+        return checks_ok && measurements.front().ok ? 0 : 1;
+    }
+
+    auto checks_ok = run_environment_checks();
+
+    std::vector<Benchmark_case> cases;
+    for (auto id: settings.scene_ids) {
+        cases.push_back({scene_name(id, settings), id});
+    }
+
+    std::vector<Benchmark_measurement> measurements;
+    for (const auto &benchmark_case: cases) {
+        std::cerr << "benchmark: " << benchmark_case.name << "..." << std::flush;
+        measurements.push_back(run_case_isolated(benchmark_case, settings));
+        std::cerr << (measurements.back().ok ? " done" : " FAILED") << " ("
+                  << measurements.back().render_median_seconds << " s)\n";
+    }
+
+    if (settings.format == "csv") {
+        write_csv(out, settings, cases, measurements);
+    } else {
+        write_json(out, settings, cases, measurements);
+    }
+
+    return checks_ok ? 0 : 1;
+}
@@ -1,42 +1,240 @@
 #ifndef RAY_TRACING_IN_CPP_BOX_H
 #define RAY_TRACING_IN_CPP_BOX_H
 
+#include <utility>
+#include <vector>
+
 #include "util.h"
 
-#include "aa_rectangle.h"
-#include "Hittable_list.h"
+#include "Hittable.h"
+#include "light.h"
+
+// Slab test against the box [box_min, box_max].
+// On success, t_hit is the entry distance (or the exit distance when the ray starts inside the box) and axis is the
+// axis of the face crossed there. NaN slabs, from axis-parallel rays starting on a face plane, are ignored.
+inline bool slab_hit(const Point3 &box_min, const Point3 &box_max, const Ray &ray, double t_min, double t_max,
+                     double &t_hit, int &axis) {
+    const Point3 *planes[2] = {&box_min, &box_max};
+    const auto &origin = ray._origin;
+    const auto &inverse_direction = ray.inverse_direction();
+
+    auto t_near = -infinity;
+    auto t_far = infinity;
+    int near_axis = 0;
+    int far_axis = 0;
+
+    for (int a = 0; a < 3; a++) {
+        auto t0 = ((*planes[ray.sign(a)])[a] - origin[a]) * inverse_direction[a];
+        auto t1 = ((*planes[1 - ray.sign(a)])[a] - origin[a]) * inverse_direction[a];
+
+        if (t0 > t_near) {
+            t_near = t0;
+            near_axis = a;
+        }
+        if (t1 < t_far) {
+            t_far = t1;
+            far_axis = a;
+        }
+    }
+
+    if (t_far < t_near) { return false; }
+
+    if (t_near >= t_min && t_near <= t_max) {
+        t_hit = t_near;
+        axis = near_axis;
+        return true;
+    }
+    if (t_far >= t_min && t_far <= t_max) {
+        t_hit = t_far;
+        axis = far_axis;
+        return true;
+    }
+
+    return false;
+}
+
+// Entry and exit distances of the whole ray through [box_min, box_max], NaN slabs ignored as in slab_test.
+inline bool slab_interval(const Point3 &box_min, const Point3 &box_max, const Ray &ray, double &t_near,
+                          double &t_far) {
+    t_near = -infinity;
+    t_far = infinity;
+    slab_test(box_min, box_max, ray, t_near, t_far);
+
+    return t_near <= t_far;
+}
+
+// Finalize a hit at distance record.t on the surface of [box_min, box_max]; the face crossed is the one nearest the
+// hit point. UVs follow the xy/xz/yz_rectangle conventions so boxes texture exactly like their six-rectangle
+// counterpart.
+inline void finalize_box_hit(const Point3 &box_min, const Point3 &box_max, const Ray &ray, const Material *material,
+                             Hit_record &record) {
+    record.point = ray.at(record.t);
+
+    int axis = 0;
+    auto nearest = infinity;
+    for (int a = 0; a < 3; a++) {
+        auto distance = fmin(fabs(record.point[a] - box_min[a]), fabs(record.point[a] - box_max[a]));
+        if (distance < nearest) {
+            nearest = distance;
+            axis = a;
+        }
+    }
+
+    Vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = record.point[axis] > 0.5 * (box_min[axis] + box_max[axis]) ? 1.0 : -1.0;
+    record.set_face_normal(ray, outward_normal);
+
+    int u_axis = axis == 0 ? 1 : 0;
+    int v_axis = axis == 2 ? 1 : 2;
+    record.u = (record.point[u_axis] - box_min[u_axis]) / (box_max[u_axis] - box_min[u_axis]);
+    record.v = (record.point[v_axis] - box_min[v_axis]) / (box_max[v_axis] - box_min[v_axis]);
+
+    record.material_ptr = material;
+}
 
 class Box : public Hittable {
 public:
     Point3 box_min;
     Point3 box_max;
-    Hittable_list sides;
+    shared_ptr<Material> material;
 
     Box() = default;
 
-    Box(const Point3 &p0, const Point3 &p1, const std::shared_ptr<Material> &material);
+    Box(const Point3 &p0, const Point3 &p1, shared_ptr<Material> _material)
+            : box_min(p0), box_max(p1), material(std::move(_material)) {}
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override {
+        finalize_box_hit(box_min, box_max, ray, material.get(), rec);
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override {
         output_box = AABB(box_min, box_max);
         return true;
     }
+
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override {
+        return slab_interval(box_min, box_max, ray, t_enter, t_exit);
+    }
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        collector.exclude(material);
+    }
 };
 
-Box::Box(const Point3 &p0, const Point3 &p1, const std::shared_ptr<Material> &material) : box_min(p0), box_max(p1) {
-    sides.add(std::make_shared<xy_rectangle>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), material));
-    sides.add(std::make_shared<xy_rectangle>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), material));
+bool Box::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Box);
+
+    double t;
+    int axis;
+    if (!slab_hit(box_min, box_max, ray, t_min, t_max, t, axis)) { return false; }
 
-    sides.add(std::make_shared<xz_rectangle>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), material));
-    sides.add(std::make_shared<xz_rectangle>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), material));
+    rec.set_hit(t, this);
 
-    sides.add(std::make_shared<yz_rectangle>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), material));
-    sides.add(std::make_shared<yz_rectangle>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), material));
+    return true;
 }
 
-bool Box::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
-    return sides.hit(ray, t_min, t_max, rec);
+// A small set of boxes stored as structure-of-arrays and slab-tested four at a time by slab_test_4. Meant for clusters
+// of neighbouring boxes inside a BVH leaf.
+class Box_group : public Hittable {
+public:
+    static const int lane_count = slab_lane_count;
+
+    Box_group() = default;
+
+    void add(const Point3 &p0, const Point3 &p1, const shared_ptr<Material> &material);
+
+    [[nodiscard]] size_t size() const { return materials.size(); }
+
+    bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
+
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override {
+        finalize_box_hit(min_of(rec.index), max_of(rec.index), ray, materials[rec.index].get(), rec);
+    }
+
+    bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        for (const auto &material: materials) { collector.exclude(material); }
+    }
+
+private:
+    // Lanes past size() are padded with empty boxes (min = +inf, max = -inf) that can never be hit.
+    std::vector<double> min_x, min_y, min_z;
+    std::vector<double> max_x, max_y, max_z;
+    std::vector<shared_ptr<Material>> materials;
+
+    [[nodiscard]] Point3 min_of(size_t i) const { return {min_x[i], min_y[i], min_z[i]}; }
+
+    [[nodiscard]] Point3 max_of(size_t i) const { return {max_x[i], max_y[i], max_z[i]}; }
+
+    int closest_box(const Ray &ray, double t_min, double t_max, double &t_hit) const;
+};
+
+void Box_group::add(const Point3 &p0, const Point3 &p1, const shared_ptr<Material> &material) {
+    auto index = materials.size();
+    materials.push_back(material);
+
+    if (index % lane_count == 0) {
+        for (auto *lane: {&min_x, &min_y, &min_z}) { lane->resize(index + lane_count, infinity); }
+        for (auto *lane: {&max_x, &max_y, &max_z}) { lane->resize(index + lane_count, -infinity); }
+    }
+
+    min_x[index] = p0.x();
+    min_y[index] = p0.y();
+    min_z[index] = p0.z();
+    max_x[index] = p1.x();
+    max_y[index] = p1.y();
+    max_z[index] = p1.z();
+}
+
+bool Box_group::bounding_box(double time0, double time1, AABB &output_box) const {
+    if (materials.empty()) { return false; }
+
+    output_box = AABB(min_of(0), max_of(0));
+    for (size_t i = 1; i < materials.size(); ++i) {
+        output_box = surrounding_box(output_box, AABB(min_of(i), max_of(i)));
+    }
+
+    return true;
+}
+
+int Box_group::closest_box(const Ray &ray, double t_min, double t_max, double &t_closest) const {
+    int closest = -1;
+    auto closest_so_far = t_max;
+
+    for (size_t base = 0; base < min_x.size(); base += lane_count) {
+        const double *const lane_min[3] = {&min_x[base], &min_y[base], &min_z[base]};
+        const double *const lane_max[3] = {&max_x[base], &max_y[base], &max_z[base]};
+        double t_near[lane_count];
+        double t_far[lane_count];
+        slab_test_4(lane_min, lane_max, ray, -infinity, infinity, t_near, t_far);
+
+        for (int lane = 0; lane < lane_count; ++lane) {
+            // The entry distance, or the exit distance when the ray starts inside the box.
+            auto t = t_near[lane] >= t_min ? t_near[lane] : t_far[lane];
+            if (t_near[lane] <= t_far[lane] && t >= t_min && t <= closest_so_far) {
+                closest_so_far = t;
+                closest = static_cast<int>(base) + lane;
+            }
+        }
+    }
+
+    t_closest = closest_so_far;
+    return closest;
+}
+
+bool Box_group::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Box_group);
+
+    double t;
+    auto index = closest_box(ray, t_min, t_max, t);
+    if (index < 0) { return false; }
+
+    rec.set_hit(t, this, index);
+
+    return true;
 }
 
 #endif //RAY_TRACING_IN_CPP_BOX_H
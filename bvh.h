@@ -1,15 +1,39 @@
 #ifndef RAY_TRACING_IN_CPP_BVH_H
 #define RAY_TRACING_IN_CPP_BVH_H
 
+#include <algorithm>
+#include <memory>
+
 #include "util.h"
 
 #include "Hittable_list.h"
 
+// Bounds of a node at both ends of the interval it was built for.
+struct Motion_bounds {
+    AABB box0;
+    AABB box1;
+    double time0 = 0;
+    double time1 = 0;
+    double inverse_duration = 0;
+};
+
+// Nodes whose contents move keep their bounds at both ends of the interval they were built for, and rays are tested
+// against the box blended to their time, so fast moving objects don't leave boxes spanning their whole path. Static
+// nodes test the one box and don't pay for the motion bounds. Near the root, where objects moving in different
+// directions end up together, a node may instead split its interval in half and hold a subtree for each half, when
+// the surface area heuristic favours that over splitting its objects.
 class Bounding_Volume_Hierarchy_node : public Hittable {
 public:
+    static const int temporal_split_depth = 6;  // levels at which a split in time is considered
+    static const int max_temporal_splits = 2;   // along any path; each doubles the nodes below it
+
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
-    AABB box;
+    AABB box;                                   // over the whole interval
+    std::unique_ptr<Motion_bounds> motion;      // null when the bounds don't move
+    double built_area = 0;
+    double split_time = 0;
+    bool time_split = false;                    // rays before split_time go left, the others right
 
     Bounding_Volume_Hierarchy_node() = default;
 
@@ -22,6 +46,35 @@ public:
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const override;
 
     bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    bool motion_bounds(double time0, double time1, AABB &output_box0, AABB &output_box1) const override;
+
+    // Recompute the boxes bottom-up for a new interval, keeping the tree's shape.
+    void refit(double time0, double time1) override;
+
+    // Build a new tree for the interval over the same objects.
+    void rebuild(double time0, double time1);
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        // Both halves of a split in time hold every object.
+        left->collect_lights(collector, offset, sampleable);
+        if (right != left && !time_split) { right->collect_lights(collector, offset, sampleable); }
+    }
+
+    // Mean factor by which refits have grown the surface area of the nodes since the tree was built. Node areas are
+    // what the surface area heuristic charges rays for, and a per-node mean keeps one huge object near the root
+    // from hiding the state of the rest of the tree.
+    [[nodiscard]] double area_growth() const;
+
+private:
+    void build(std::vector<shared_ptr<Hittable>> &objects, size_t start, size_t end, double time0, double time1,
+               int depth = 0, int temporal_splits = 0);
+
+    void fit(double time0, double time1);
+
+    void collect_objects(std::vector<shared_ptr<Hittable>> &objects) const;
+
+    void add_area_growth(double &sum, int &count) const;
 };
 
 using BVH_node = Bounding_Volume_Hierarchy_node;
@@ -31,8 +84,26 @@ bool BVH_node::bounding_box(double time0, double time1, AABB &output_box) const
     return true;
 }
 
+bool BVH_node::motion_bounds(double time0, double time1, AABB &output_box0, AABB &output_box1) const {
+    if (motion && time0 == motion->time0 && time1 == motion->time1) {
+        output_box0 = motion->box0;
+        output_box1 = motion->box1;
+    } else {
+        output_box0 = output_box1 = box;
+    }
+    return true;
+}
+
 bool BVH_node::hit(const Ray &ray, double t_min, double t_max, Hit_record &record) const {
-    if (!box.hit(ray, t_min, t_max)) { return false; }
+    RT_STAT_BVH_NODE();
+    if (motion) {
+        auto blend = std::clamp((ray.time() - motion->time0) * motion->inverse_duration, 0.0, 1.0);
+        if (!hit_blended(motion->box0, motion->box1, blend, ray, t_min, t_max)) { return false; }
+    } else if (!box.hit(ray, t_min, t_max)) {
+        return false;
+    }
+
+    if (time_split) { return (ray.time() < split_time ? left : right)->hit(ray, t_min, t_max, record); }
 
     bool hit_left = left->hit(ray, t_min, t_max, record);
     bool hit_right = right->hit(ray, t_min, hit_left ? record.t : t_max, record);
@@ -40,47 +111,74 @@ bool BVH_node::hit(const Ray &ray, double t_min, double t_max, Hit_record &recor
     return hit_left || hit_right;
 }
 
-inline bool box_compare(const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b, int axis) {
-    AABB box_a;
-    AABB box_b;
+// Order two objects by the low side of their boxes halfway through the interval along axis.
+inline bool box_compare(const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b, int axis, double time0,
+                        double time1) {
+    AABB box_a0;
+    AABB box_a1;
+    AABB box_b0;
+    AABB box_b1;
 
-    if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b)) {
+    if (!a->motion_bounds(time0, time1, box_a0, box_a1) || !b->motion_bounds(time0, time1, box_b0, box_b1)) {
         std::cerr << "No bounding box in bvh_node constructor.\n";
     }
 
-    return box_a.min().coordinates[axis] < box_b.min().coordinates[axis];
+    return box_a0.min()[axis] + box_a1.min()[axis] < box_b0.min()[axis] + box_b1.min()[axis];
 }
 
-inline bool box_x_compare(const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b) {
-    return box_compare(a, b, 0);
-}
+inline void range_motion_bounds(const std::vector<shared_ptr<Hittable>> &objects, size_t start, size_t end,
+                                double time0, double time1, AABB &box0, AABB &box1) {
+    objects[start]->motion_bounds(time0, time1, box0, box1);
 
-inline bool box_y_compare(const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b) {
-    return box_compare(a, b, 1);
+    AABB object_box0;
+    AABB object_box1;
+    for (auto i = start + 1; i < end; ++i) {
+        objects[i]->motion_bounds(time0, time1, object_box0, object_box1);
+        box0 = surrounding_box(box0, object_box0);
+        box1 = surrounding_box(box1, object_box1);
+    }
 }
 
-inline bool box_z_compare(const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b) {
-    return box_compare(a, b, 2);
-}
+// Surface area heuristic comparison of splitting the objects in two at mid against splitting the interval in half
+// with all of the objects on both sides: a ray may visit both children of the first but only one of the second.
+// The area of a moving box is taken as the mean of its areas at both ends.
+inline bool temporal_split_pays(const std::vector<shared_ptr<Hittable>> &objects, size_t start, size_t mid,
+                                size_t end, double time0, double time1) {
+    AABB box0;
+    AABB box1;
+    range_motion_bounds(objects, start, end, time0, time1, box0, box1);
+    if (box0 == box1) { return false; }
 
-bool (*get_random_box_compare())(const shared_ptr<Hittable> &, const shared_ptr<Hittable> &) {
-    int axis = random_int(0, 2);
+    auto cost = [&objects](size_t from, size_t to, double t0, double t1) {
+        AABB from_box0;
+        AABB from_box1;
+        range_motion_bounds(objects, from, to, t0, t1, from_box0, from_box1);
+        return double(to - from) * (from_box0.surface_area() + from_box1.surface_area()) / 2;
+    };
 
-    if (axis == 0) {
-        return &box_x_compare;
-    }
-    if (axis == 1) {
-        return &box_y_compare;
-    }
-    return &box_z_compare;
+    auto split_time = (time0 + time1) / 2;
+    auto object_split_cost = cost(start, mid, time0, time1) + cost(mid, end, time0, time1);
+    auto time_split_cost = (cost(start, end, time0, split_time) + cost(start, end, split_time, time1)) / 2;
+
+    return time_split_cost < object_split_cost;
 }
 
 BVH_node::Bounding_Volume_Hierarchy_node(const vector<shared_ptr<Hittable>> &src_objects,
                                          size_t start, size_t end, double time0, double time1) {
-    auto objects = src_objects; // modifiable array of the source
+    RT_TRACE_SCOPE("bvh_build", static_cast<long long>(end - start));
 
-    auto comparator = get_random_box_compare();
+    auto objects = src_objects; // modifiable array of the source, shared by the whole subtree
+    build(objects, start, end, time0, time1);
+}
+
+void BVH_node::build(std::vector<shared_ptr<Hittable>> &objects, size_t start, size_t end, double time0,
+                     double time1, int depth, int temporal_splits) {
+    auto axis = random_int(0, 2);
+    auto comparator = [axis, time0, time1](const shared_ptr<Hittable> &a, const shared_ptr<Hittable> &b) {
+        return box_compare(a, b, axis, time0, time1);
+    };
 
+    time_split = false;
 
     if (size_t object_span = end - start; object_span == 1) {
         left = right = objects[start];
@@ -95,19 +193,113 @@ BVH_node::Bounding_Volume_Hierarchy_node(const vector<shared_ptr<Hittable>> &src
     } else {
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
         auto mid = start + object_span / 2;
-        left = std::make_shared<BVH_node>(objects, start, mid, time0, time1);
-        right = std::make_shared<BVH_node>(objects, mid, end, time0, time1);
+        auto left_node = std::make_shared<BVH_node>();
+        auto right_node = std::make_shared<BVH_node>();
+
+        time_split = depth < temporal_split_depth && temporal_splits < max_temporal_splits &&
+                     temporal_split_pays(objects, start, mid, end, time0, time1);
+        if (time_split) {
+            auto half_time = (time0 + time1) / 2;
+            left_node->build(objects, start, end, time0, half_time, depth + 1, temporal_splits + 1);
+            right_node->build(objects, start, end, half_time, time1, depth + 1, temporal_splits + 1);
+        } else {
+            left_node->build(objects, start, mid, time0, time1, depth + 1, temporal_splits);
+            right_node->build(objects, mid, end, time0, time1, depth + 1, temporal_splits);
+        }
+        left = left_node;
+        right = right_node;
     }
 
-    AABB box_left;
-    AABB box_right;
+    fit(time0, time1);
+    built_area = box.surface_area();
+}
+
+void BVH_node::fit(double time0, double time1) {
+    if (time_split) {
+        split_time = (time0 + time1) / 2;
+
+        AABB box_left;
+        AABB box_right;
+        if (!left->bounding_box(time0, split_time, box_left) || !right->bounding_box(split_time, time1, box_right)) {
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+        }
+
+        box = surrounding_box(box_left, box_right);
+        motion.reset();
+        return;
+    }
 
-    if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right)) {
+    AABB left0;
+    AABB left1;
+    AABB right0;
+    AABB right1;
+
+    if (!left->motion_bounds(time0, time1, left0, left1) || !right->motion_bounds(time0, time1, right0, right1)) {
         std::cerr << "No bounding box in bvh_node constructor.\n";
     }
 
-    box = surrounding_box(box_left, box_right);
+    auto box0 = surrounding_box(left0, right0);
+    auto box1 = surrounding_box(left1, right1);
+    box = surrounding_box(box0, box1);
+
+    if (!(box0 == box1) && time1 > time0) {
+        motion = std::make_unique<Motion_bounds>(Motion_bounds{box0, box1, time0, time1, 1 / (time1 - time0)});
+    } else {
+        motion.reset();
+    }
+}
+
+void BVH_node::refit(double time0, double time1) {
+    if (time_split) {
+        left->refit(time0, (time0 + time1) / 2);
+        right->refit((time0 + time1) / 2, time1);
+    } else {
+        left->refit(time0, time1);
+        if (right != left) { right->refit(time0, time1); }
+    }
+
+    fit(time0, time1);
+}
+
+void BVH_node::rebuild(double time0, double time1) {
+    RT_TRACE_SCOPE("bvh_rebuild");
+
+    std::vector<shared_ptr<Hittable>> objects;
+    collect_objects(objects);
+    build(objects, 0, objects.size(), time0, time1);
+}
+
+double BVH_node::area_growth() const {
+    double sum = 0;
+    int count = 0;
+    add_area_growth(sum, count);
+    return sum / count;
 }
 
+void BVH_node::collect_objects(std::vector<shared_ptr<Hittable>> &objects) const {
+    auto collect = [&objects](const shared_ptr<Hittable> &child) {
+        if (auto node = std::dynamic_pointer_cast<BVH_node>(child)) {
+            node->collect_objects(objects);
+        } else {
+            objects.push_back(child);
+        }
+    };
+
+    // Both halves of a split in time hold every object.
+    collect(left);
+    if (right != left && !time_split) { collect(right); }
+}
+
+void BVH_node::add_area_growth(double &sum, int &count) const {
+    sum += built_area > 0 ? box.surface_area() / built_area : 1.0;
+    ++count;
+
+    auto add_child = [&sum, &count](const shared_ptr<Hittable> &child) {
+        if (const auto *node = dynamic_cast<const BVH_node *>(child.get())) { node->add_area_growth(sum, count); }
+    };
+
+    add_child(left);
+    if (right != left) { add_child(right); }
+}
 
 #endif //RAY_TRACING_IN_CPP_BVH_H
@@ -0,0 +1,187 @@
+#ifndef RAY_TRACING_IN_CPP_CHECKPOINT_H
+#define RAY_TRACING_IN_CPP_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "render.h"
+
+// Accumulation file, used both as a render checkpoint and as the output of a sample-range render: this header, the
+// float sums (three per pixel), the per-pixel sample counts, then for every band of rows its generator state as a
+// 32-bit length and the text mt19937 writes with operator<<.
+struct Checkpoint_header {
+    char magic[4];                    // "RTCK"
+    std::uint32_t version;            // 4
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t max_depth;
+    std::uint32_t seed;
+    std::uint32_t samples_per_pass;
+    std::uint32_t band_count;
+    std::uint32_t first_sample;       // see Accumulation_buffer
+    std::uint32_t rows_per_band;
+    std::uint64_t scene_identity;     // see Scene::identity
+};
+
+const std::uint32_t checkpoint_version = 4;
+
+// Write the buffer to path, replacing any earlier checkpoint only once the new one is complete.
+bool write_checkpoint(const std::string &path, const Image &image, std::uint64_t scene_identity, int samples_per_pass,
+                      const Accumulation_buffer &buffer) {
+    RT_TRACE_SCOPE("checkpoint_write");
+
+    Checkpoint_header header{};
+    std::memcpy(header.magic, "RTCK", 4);
+    header.version = checkpoint_version;
+    header.width = buffer.width;
+    header.height = buffer.height;
+    header.max_depth = image.max_depth;
+    header.seed = image.seed;
+    header.samples_per_pass = samples_per_pass;
+    header.band_count = buffer.band_count();
+    header.first_sample = buffer.first_sample;
+    header.rows_per_band = buffer.rows_per_band;
+    header.scene_identity = scene_identity;
+
+    auto temporary_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(temporary_path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (int band = 0; band < buffer.band_count(); ++band) {
+            out.write(reinterpret_cast<const char *>(buffer.band_sums(band)),
+                      static_cast<std::streamsize>(3 * size_t(buffer.band_rows(band)) * buffer.width * sizeof(float)));
+        }
+        for (int band = 0; band < buffer.band_count(); ++band) {
+            out.write(reinterpret_cast<const char *>(buffer.band_counts(band)),
+                      static_cast<std::streamsize>(size_t(buffer.band_rows(band)) * buffer.width *
+                                                   sizeof(std::uint32_t)));
+        }
+
+        for (const auto &generator: buffer.band_generators) {
+            std::ostringstream state;
+            state << generator;
+            auto text = state.str();
+            auto size = static_cast<std::uint32_t>(text.size());
+            out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            out.write(text.data(), size);
+        }
+
+        if (!out.flush()) {
+            std::cerr << "ERROR: Could not write checkpoint '" << temporary_path << "'.\n";
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not write checkpoint '" << path << "'.\n";
+        std::remove(temporary_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Load any accumulation file, whatever image it was written for.
+bool read_accumulation_file(const std::string &path, Checkpoint_header &header, Accumulation_buffer &buffer) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "ERROR: Could not open accumulation file '" << path << "'.\n";
+        return false;
+    }
+
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, "RTCK", 4) != 0 || header.version != checkpoint_version) {
+        std::cerr << "ERROR: '" << path << "' is not an accumulation file.\n";
+        return false;
+    }
+
+    const auto max_size = static_cast<std::uint32_t>(std::numeric_limits<int>::max());
+    if (header.width == 0 || header.width > max_size || header.height == 0 || header.height > max_size ||
+        header.rows_per_band == 0 || header.rows_per_band > max_size) {
+        std::cerr << "ERROR: Accumulation file '" << path << "' has an invalid image size.\n";
+        return false;
+    }
+    if (header.band_count != (std::uint64_t(header.height) + header.rows_per_band - 1) / header.rows_per_band) {
+        std::cerr << "ERROR: Accumulation file '" << path << "' uses a different band layout.\n";
+        return false;
+    }
+
+    // The sums and counts must all be there before the buffer is allocated for them; generator states follow.
+    auto data_start = in.tellg();
+    in.seekg(0, std::ios::end);
+    auto data_size = static_cast<std::uint64_t>(in.tellg() - data_start);
+    in.seekg(data_start);
+    if (std::uint64_t(header.width) * header.height > data_size / (3 * sizeof(float) + sizeof(std::uint32_t))) {
+        std::cerr << "ERROR: Accumulation file '" << path << "' is truncated.\n";
+        return false;
+    }
+
+    buffer = Accumulation_buffer(static_cast<int>(header.width), static_cast<int>(header.height), header.seed,
+                                 header.first_sample, static_cast<int>(header.rows_per_band));
+
+    for (int band = 0; band < buffer.band_count(); ++band) {
+        in.read(reinterpret_cast<char *>(buffer.band_sums(band)),
+                static_cast<std::streamsize>(3 * size_t(buffer.band_rows(band)) * buffer.width * sizeof(float)));
+    }
+    for (int band = 0; band < buffer.band_count(); ++band) {
+        in.read(reinterpret_cast<char *>(buffer.band_counts(band)),
+                static_cast<std::streamsize>(size_t(buffer.band_rows(band)) * buffer.width * sizeof(std::uint32_t)));
+    }
+
+    for (auto &generator: buffer.band_generators) {
+        std::uint32_t size = 0;
+        in.read(reinterpret_cast<char *>(&size), sizeof(size));
+        if (size > (1u << 16)) { in.setstate(std::ios::failbit); }
+        std::string text(in ? size : 0, '\0');
+        in.read(text.data(), size);
+
+        std::istringstream state(text);
+        state >> generator;
+        if (!state) { in.setstate(std::ios::failbit); }
+    }
+
+    if (!in) {
+        std::cerr << "ERROR: Accumulation file '" << path << "' is truncated.\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Load a checkpoint written for the same scene (see Scene::identity), image size, depth, seed and first sample. The
+// sample target may differ, so a finished render can be resumed to add samples.
+bool read_checkpoint(const std::string &path, const Image &image, std::uint64_t scene_identity,
+                     unsigned int first_sample, int &samples_per_pass, Accumulation_buffer &buffer) {
+    Checkpoint_header header{};
+    if (!read_accumulation_file(path, header, buffer)) { return false; }
+
+    if (header.width != static_cast<std::uint32_t>(image.width) ||
+        header.height != static_cast<std::uint32_t>(image.height) ||
+        header.max_depth != static_cast<std::uint32_t>(image.max_depth) ||
+        header.seed != image.seed || header.first_sample != first_sample ||
+        header.rows_per_band != static_cast<std::uint32_t>(image.tile_rows)) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was written for a " << header.width << 'x' << header.height
+                  << " image with depth " << header.max_depth << ", seed " << header.seed << ", first sample "
+                  << header.first_sample << " and " << header.rows_per_band << "-row tiles.\n";
+        return false;
+    }
+
+    if (header.scene_identity != scene_identity) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was written for a different scene or different scene settings.\n";
+        return false;
+    }
+
+    samples_per_pass = static_cast<int>(header.samples_per_pass);
+    return true;
+}
+
+#endif //RAY_TRACING_IN_CPP_CHECKPOINT_H
@@ -0,0 +1,443 @@
+#ifndef RAY_TRACING_IN_CPP_COMPILED_SCENE_H
+#define RAY_TRACING_IN_CPP_COMPILED_SCENE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#include "aa_rectangle.h"
+#include "box.h"
+#include "Hittable.h"
+#include "Moving_sphere.h"
+#include "Sphere.h"
+
+// Compiled scene cache: the flat primitives of a scene file, their material names and a finished BVH over them,
+// written once and memory-mapped read-only by later runs. Nothing is copied out of the mapping, so processes
+// rendering the same scene share its pages. Anything that doesn't flatten (transforms, media, groups, definitions)
+// stays in the residual scene text stored alongside and is parsed as usual.
+
+enum class Compiled_kind : std::uint32_t {
+    Sphere, Moving_sphere, xy_rectangle, xz_rectangle, yz_rectangle, Box
+};
+
+// Parameters in constructor order, e.g. center and radius for a sphere, x0 x1 y0 y1 k for an xy rectangle.
+struct Compiled_primitive {
+    Compiled_kind kind = Compiled_kind::Sphere;
+    std::uint32_t material = 0;   // index into the material name table
+    double data[9] = {};
+};
+
+// Nodes are stored depth first: an interior node's first child follows it, the second is at offset.
+struct Compiled_bvh_node {
+    double bounds_min[3];
+    double bounds_max[3];
+    std::uint32_t offset;   // first primitive of a leaf, second child of an interior node
+    std::uint32_t count;    // primitives in a leaf, 0 for interior nodes
+    std::uint32_t axis;     // split axis of an interior node
+    std::uint32_t padding;
+};
+
+struct Compiled_scene_header {
+    char magic[4];          // "RTSC"
+    std::uint32_t version;
+    std::uint64_t content_hash;
+    std::uint64_t file_size;
+    std::uint64_t residual_offset;
+    std::uint64_t residual_size;
+    std::uint64_t material_names_offset;   // '\n'-terminated names
+    std::uint64_t material_names_size;
+    std::uint64_t material_count;
+    std::uint64_t primitive_offset;
+    std::uint64_t primitive_count;
+    std::uint64_t node_offset;
+    std::uint64_t node_count;
+};
+
+const std::uint32_t compiled_scene_version = 1;
+
+// 64-bit FNV-1a over size bytes, continuing from hash.
+inline std::uint64_t hash_bytes(const void *data, size_t size, std::uint64_t hash = 14695981039346656037ull) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Salted with the format version so a format change invalidates every cache entry.
+inline std::uint64_t scene_content_hash(std::string_view text) {
+    return hash_bytes(text.data(), text.size(), 14695981039346656037ull ^ compiled_scene_version);
+}
+
+inline std::string compiled_scene_path(const std::string &directory, std::uint64_t content_hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.rtsc", static_cast<unsigned long long>(content_hash));
+    return directory + '/' + name;
+}
+
+shared_ptr<Hittable> make_primitive(const Compiled_primitive &primitive, shared_ptr<Material> material) {
+    const auto *d = primitive.data;
+    switch (primitive.kind) {
+        case Compiled_kind::Sphere:
+            return make_shared<Sphere>(Point3(d[0], d[1], d[2]), d[3], std::move(material));
+        case Compiled_kind::Moving_sphere:
+            return make_shared<Moving_sphere>(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]), d[6], d[7], d[8],
+                                              std::move(material));
+        case Compiled_kind::xy_rectangle:
+            return make_shared<xy_rectangle>(d[0], d[1], d[2], d[3], d[4], material);
+        case Compiled_kind::xz_rectangle:
+            return make_shared<xz_rectangle>(d[0], d[1], d[2], d[3], d[4], material);
+        case Compiled_kind::yz_rectangle:
+            return make_shared<yz_rectangle>(d[0], d[1], d[2], d[3], d[4], material);
+        default:
+            return make_shared<Box>(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]), std::move(material));
+    }
+}
+
+// Call visit with a material-less stack copy of the primitive's Hittable, built straight from its record.
+template<typename Visitor>
+inline auto visit_primitive(const Compiled_primitive &primitive, Visitor &&visit) {
+    const auto *d = primitive.data;
+    switch (primitive.kind) {
+        case Compiled_kind::Sphere:
+            return visit(Sphere(Point3(d[0], d[1], d[2]), d[3], nullptr));
+        case Compiled_kind::Moving_sphere:
+            return visit(Moving_sphere(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]), d[6], d[7], d[8], nullptr));
+        case Compiled_kind::xy_rectangle:
+            return visit(xy_rectangle(d[0], d[1], d[2], d[3], d[4], nullptr));
+        case Compiled_kind::xz_rectangle:
+            return visit(xz_rectangle(d[0], d[1], d[2], d[3], d[4], nullptr));
+        case Compiled_kind::yz_rectangle:
+            return visit(yz_rectangle(d[0], d[1], d[2], d[3], d[4], nullptr));
+        default:
+            return visit(Box(Point3(d[0], d[1], d[2]), Point3(d[3], d[4], d[5]), nullptr));
+    }
+}
+
+// Collects flat primitives while a scene file is parsed, then writes them out with their BVH.
+class Compiled_scene_builder {
+public:
+    std::string residual;
+
+    void add(const Compiled_primitive &primitive, const shared_ptr<Material> &material, std::string_view name);
+
+    [[nodiscard]] bool write(const std::string &path, std::uint64_t content_hash);
+
+private:
+    static const std::uint32_t max_leaf_size = 4;
+
+    std::vector<Compiled_primitive> primitives;
+    std::vector<AABB> boxes;
+    std::vector<std::string> material_names;
+    std::unordered_map<std::string_view, std::uint32_t> material_indices;
+    std::vector<Compiled_bvh_node> nodes;
+
+    void build(std::vector<std::uint32_t> &order, std::uint32_t start, std::uint32_t end);
+};
+
+void Compiled_scene_builder::add(const Compiled_primitive &primitive, const shared_ptr<Material> &material,
+                                 std::string_view name) {
+    auto found = material_indices.find(name);
+    if (found == material_indices.end()) {
+        material_names.emplace_back(name);
+        found = material_indices.emplace(name, static_cast<std::uint32_t>(material_names.size() - 1)).first;
+    }
+
+    primitives.push_back(primitive);
+    primitives.back().material = found->second;
+
+    AABB box;
+    make_primitive(primitive, material)->bounding_box(0, 1, box);
+    boxes.push_back(box);
+}
+
+void Compiled_scene_builder::build(std::vector<std::uint32_t> &order, std::uint32_t start, std::uint32_t end) {
+    auto node_index = nodes.size();
+    nodes.emplace_back();
+
+    AABB bounds = boxes[order[start]];
+    Point3 centroid_min = 0.5 * (bounds.min() + bounds.max());
+    Point3 centroid_max = centroid_min;
+    for (auto i = start; i < end; ++i) {
+        const auto &box = boxes[order[i]];
+        bounds = surrounding_box(bounds, box);
+        auto centroid = 0.5 * (box.min() + box.max());
+        for (int a = 0; a < 3; ++a) {
+            centroid_min[a] = fmin(centroid_min[a], centroid[a]);
+            centroid_max[a] = fmax(centroid_max[a], centroid[a]);
+        }
+    }
+
+    for (int a = 0; a < 3; ++a) {
+        nodes[node_index].bounds_min[a] = bounds.min()[a];
+        nodes[node_index].bounds_max[a] = bounds.max()[a];
+    }
+
+    if (end - start <= max_leaf_size) {
+        nodes[node_index].offset = start;
+        nodes[node_index].count = end - start;
+        return;
+    }
+
+    // Median split on the longest axis of the centroids.
+    auto extent = centroid_max - centroid_min;
+    int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    auto mid = start + (end - start) / 2;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                     [this, axis](std::uint32_t a, std::uint32_t b) {
+                         return boxes[a].min()[axis] + boxes[a].max()[axis] <
+                                boxes[b].min()[axis] + boxes[b].max()[axis];
+                     });
+
+    build(order, start, mid);
+    nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+    nodes[node_index].count = 0;
+    nodes[node_index].axis = axis;
+    build(order, mid, end);
+}
+
+bool Compiled_scene_builder::write(const std::string &path, std::uint64_t content_hash) {
+    nodes.clear();
+    std::vector<Compiled_primitive> ordered;
+    if (!primitives.empty()) {
+        std::vector<std::uint32_t> order(primitives.size());
+        for (std::uint32_t i = 0; i < order.size(); ++i) { order[i] = i; }
+        build(order, 0, static_cast<std::uint32_t>(order.size()));
+
+        ordered.reserve(primitives.size());
+        for (auto index: order) { ordered.push_back(primitives[index]); }
+    }
+
+    std::string names;
+    for (const auto &name: material_names) {
+        names += name;
+        names += '\n';
+    }
+
+    auto align = [](std::uint64_t offset) { return (offset + 63) & ~std::uint64_t(63); };
+
+    Compiled_scene_header header{};
+    std::memcpy(header.magic, "RTSC", 4);
+    header.version = compiled_scene_version;
+    header.content_hash = content_hash;
+    header.node_offset = align(sizeof(header));
+    header.node_count = nodes.size();
+    header.primitive_offset = align(header.node_offset + nodes.size() * sizeof(Compiled_bvh_node));
+    header.primitive_count = ordered.size();
+    header.material_names_offset = header.primitive_offset + ordered.size() * sizeof(Compiled_primitive);
+    header.material_names_size = names.size();
+    header.material_count = material_names.size();
+    header.residual_offset = header.material_names_offset + names.size();
+    header.residual_size = residual.size();
+    header.file_size = header.residual_offset + residual.size();
+
+    // Written under a temporary name and renamed, so concurrent renders never map a partial file.
+    auto temporary_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(temporary_path, std::ios::binary);
+        if (!out) {
+            std::cerr << "ERROR: Could not write compiled scene '" << temporary_path << "'.\n";
+            return false;
+        }
+
+        auto pad_to = [&out](std::uint64_t offset) {
+            while (static_cast<std::uint64_t>(out.tellp()) < offset) { out.put('\0'); }
+        };
+
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        pad_to(header.node_offset);
+        out.write(reinterpret_cast<const char *>(nodes.data()),
+                  static_cast<std::streamsize>(nodes.size() * sizeof(Compiled_bvh_node)));
+        pad_to(header.primitive_offset);
+        out.write(reinterpret_cast<const char *>(ordered.data()),
+                  static_cast<std::streamsize>(ordered.size() * sizeof(Compiled_primitive)));
+        out.write(names.data(), static_cast<std::streamsize>(names.size()));
+        out.write(residual.data(), static_cast<std::streamsize>(residual.size()));
+
+        if (!out) {
+            std::cerr << "ERROR: Could not write compiled scene '" << temporary_path << "'.\n";
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not write compiled scene '" << path << "'.\n";
+        std::remove(temporary_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Read-only view of a compiled scene file; the BVH and primitives are traversed in place.
+class Compiled_scene : public Hittable {
+public:
+    std::vector<shared_ptr<Material>> materials;   // resolved from material_names() by the scene parser
+
+    Compiled_scene() = default;
+
+    ~Compiled_scene() override;
+
+    Compiled_scene(const Compiled_scene &) = delete;
+
+    Compiled_scene &operator=(const Compiled_scene &) = delete;
+
+    // Map path, failing quietly when it is missing, stale or not a compiled scene for content_hash.
+    bool map(const std::string &path, std::uint64_t content_hash);
+
+    [[nodiscard]] std::string_view residual_text() const {
+        return {static_cast<const char *>(mapping) + header->residual_offset, header->residual_size};
+    }
+
+    [[nodiscard]] std::vector<std::string_view> material_names() const;
+
+    [[nodiscard]] std::uint64_t primitive_count() const { return header->primitive_count; }
+
+    bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
+
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override;
+
+    bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override {
+        for (std::uint64_t i = 0; i < header->primitive_count; ++i) {
+            make_primitive(primitives[i], materials[primitives[i].material])->collect_lights(collector, offset,
+                                                                                            sampleable);
+        }
+    }
+
+private:
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+    const Compiled_scene_header *header = nullptr;
+    const Compiled_bvh_node *nodes = nullptr;
+    const Compiled_primitive *primitives = nullptr;
+};
+
+Compiled_scene::~Compiled_scene() {
+    if (mapping != nullptr) { munmap(mapping, mapping_size); }
+}
+
+bool Compiled_scene::map(const std::string &path, std::uint64_t content_hash) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) { return false; }
+
+    struct stat status{};
+    auto file_size = fstat(descriptor, &status) == 0 ? static_cast<size_t>(status.st_size) : 0;
+    void *view = file_size >= sizeof(Compiled_scene_header)
+                 ? mmap(nullptr, file_size, PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if (view == MAP_FAILED) { return false; }
+
+    const auto *candidate = static_cast<const Compiled_scene_header *>(view);
+    auto fits = [file_size](std::uint64_t offset, std::uint64_t count, std::uint64_t size) {
+        return offset <= file_size && count <= (file_size - offset) / size;
+    };
+
+    if (std::memcmp(candidate->magic, "RTSC", 4) != 0 || candidate->version != compiled_scene_version ||
+        candidate->content_hash != content_hash || candidate->file_size != file_size ||
+        !fits(candidate->node_offset, candidate->node_count, sizeof(Compiled_bvh_node)) ||
+        !fits(candidate->primitive_offset, candidate->primitive_count, sizeof(Compiled_primitive)) ||
+        !fits(candidate->material_names_offset, candidate->material_names_size, 1) ||
+        !fits(candidate->residual_offset, candidate->residual_size, 1)) {
+        munmap(view, file_size);
+        return false;
+    }
+
+    mapping = view;
+    mapping_size = file_size;
+    header = candidate;
+    nodes = reinterpret_cast<const Compiled_bvh_node *>(static_cast<const char *>(view) + header->node_offset);
+    primitives = reinterpret_cast<const Compiled_primitive *>(static_cast<const char *>(view) +
+                                                              header->primitive_offset);
+    return true;
+}
+
+std::vector<std::string_view> Compiled_scene::material_names() const {
+    std::string_view names(static_cast<const char *>(mapping) + header->material_names_offset,
+                           header->material_names_size);
+
+    std::vector<std::string_view> result;
+    while (!names.empty()) {
+        auto end = names.find('\n');
+        if (end == std::string_view::npos) { end = names.size(); }
+        result.push_back(names.substr(0, end));
+        names.remove_prefix(std::min(end + 1, names.size()));
+    }
+    return result;
+}
+
+bool Compiled_scene::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    if (header->node_count == 0) { return false; }
+
+    std::uint32_t stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    while (stack_size > 0) {
+        const auto &node = nodes[stack[--stack_size]];
+        RT_STAT_BVH_NODE();
+
+        AABB box(Point3(node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]),
+                 Point3(node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]));
+        if (!box.hit(ray, t_min, closest_so_far)) { continue; }
+
+        if (node.count > 0) {
+            for (auto i = node.offset; i < node.offset + node.count; ++i) {
+                auto hit = visit_primitive(primitives[i], [&](const Hittable &primitive) {
+                    return primitive.hit(ray, t_min, closest_so_far, rec);
+                });
+                if (hit) {
+                    // The record names the stack copy, which is gone by the time the hit is finalized.
+                    rec.set_hit(rec.t, this, static_cast<int>(i));
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            continue;
+        }
+
+        // Visit the child on the ray's side of the split first; it is popped last.
+        auto first = static_cast<std::uint32_t>(&node - nodes) + 1;
+        auto second = node.offset;
+        if (ray.sign(static_cast<int>(node.axis))) { std::swap(first, second); }
+        stack[stack_size++] = second;
+        stack[stack_size++] = first;
+    }
+
+    return hit_anything;
+}
+
+void Compiled_scene::finalize_hit(const Ray &ray, Hit_record &rec) const {
+    const auto &primitive = primitives[rec.index];
+    visit_primitive(primitive, [&](const Hittable &copy) { copy.finalize_hit(ray, rec); });
+    rec.material_ptr = materials[primitive.material].get();
+}
+
+bool Compiled_scene::bounding_box(double time0, double time1, AABB &output_box) const {
+    if (header->node_count == 0) { return false; }
+
+    output_box = AABB(Point3(nodes[0].bounds_min[0], nodes[0].bounds_min[1], nodes[0].bounds_min[2]),
+                      Point3(nodes[0].bounds_max[0], nodes[0].bounds_max[1], nodes[0].bounds_max[2]));
+    return true;
+}
+
+#endif //RAY_TRACING_IN_CPP_COMPILED_SCENE_H
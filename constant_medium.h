@@ -27,52 +27,60 @@ public:
 
     bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
 
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override {
+        rec.point = ray.at(rec.t);
+        rec.normal = Vec3(1, 0, 0); // arbitrary
+        rec.front_face = true;  // also arbitrary
+        rec.material_ptr = phase_function.get();
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) const override {
         return boundary->bounding_box(time0, time1, output_box);
     }
+
+    bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const override {
+        return boundary->motion_bounds(time0, time1, box0, box1);
+    }
+
+    void refit(double time0, double time1) override { boundary->refit(time0, time1); }
 };
 
 bool Constant_medium::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Constant_medium);
+
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
 
-    Hit_record rec1;
-    Hit_record rec2;
+    double t_enter;
+    double t_exit;
 
-    if (!boundary->hit(ray, -infinity, infinity, rec1)) { return false; }
+    if (!boundary->boundary_interval(ray, t_enter, t_exit)) { return false; }
 
-    if (!boundary->hit(ray, rec1.t + 0.0001, infinity, rec2)) { return false; }
+    if (debugging) { std::cerr << "\nt_min=" << t_enter << ", t_max=" << t_exit << '\n'; }
 
-    if (debugging) { std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n'; }
+    if (t_enter < t_min) { t_enter = t_min; }
+    if (t_exit > t_max) { t_exit = t_max; }
 
-    if (rec1.t < t_min) { rec1.t = t_min; }
-    if (rec2.t > t_max) { rec2.t = t_max; }
+    if (t_enter >= t_exit) { return false; }
 
-    if (rec1.t >= rec2.t) { return false; }
-
-    if (rec1.t < 0) { rec1.t = 0; }
+    if (t_enter < 0) { t_enter = 0; }
 
     const auto ray_length = ray.direction().length();
-    const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    const auto distance_inside_boundary = (t_exit - t_enter) * ray_length;
     const auto hit_distance = neg_inv_density * log(random_double());
 
     if (hit_distance > distance_inside_boundary)
         return false;
 
-    rec.t = rec1.t + hit_distance / ray_length;
-    rec.point = ray.at(rec.t);
+    rec.set_hit(t_enter + hit_distance / ray_length, this);
 
     if (debugging) {
         std::cerr << "hit_distance = " << hit_distance << '\n'
                   << "rec.t = " << rec.t << '\n'
-                  << "rec.p = " << rec.point << '\n';
+                  << "rec.p = " << ray.at(rec.t) << '\n';
     }
 
-    rec.normal = Vec3(1, 0, 0); // arbitrary
-    rec.front_face = true;  // also arbitrary
-    rec.material_ptr = phase_function;
-
     return true;
 }
 
@@ -0,0 +1,333 @@
+#ifndef RAY_TRACING_IN_CPP_DISTRIBUTED_H
+#define RAY_TRACING_IN_CPP_DISTRIBUTED_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "render.h"
+
+// Distributed rendering over TCP. The coordinator hands out bands of the Accumulation_buffer; every worker thread
+// holds its own connection, renders each band it is given with all of its samples from the band's initial
+// generator, and sends back the band's float sums. A band is therefore the same whoever renders it, and the merged
+// image matches a single-process render with the same seed. Bands held by a worker whose connection drops are
+// handed out again. Messages are raw structs and floats: coordinator and workers must share the byte order.
+//
+//   worker -> coordinator   Worker_hello, once per connection
+//   coordinator -> worker   int32 band index, or -1 when there is no work left
+//   worker -> coordinator   Band_result_header followed by value_count floats
+
+struct Worker_hello {
+    char magic[4];          // "RTDW"
+    std::uint32_t version;  // 3
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t sample_per_pixel;
+    std::uint32_t max_depth;
+    std::uint32_t seed;
+    std::uint32_t tile_rows;
+    std::uint64_t scene_identity;   // see Scene::identity
+};
+
+struct Band_result_header {
+    std::int32_t band;
+    std::uint32_t value_count;
+    std::uint64_t rays;
+};
+
+const std::uint32_t distributed_version = 3;
+
+inline Worker_hello make_worker_hello(const Image &image, std::uint64_t scene_identity) {
+    Worker_hello hello{};
+    std::memcpy(hello.magic, "RTDW", 4);
+    hello.version = distributed_version;
+    hello.width = image.width;
+    hello.height = image.height;
+    hello.sample_per_pixel = image.sample_per_pixel;
+    hello.max_depth = image.max_depth;
+    hello.seed = image.seed;
+    hello.tile_rows = image.tile_rows;
+    hello.scene_identity = scene_identity;
+    return hello;
+}
+
+inline bool send_all(int socket, const void *data, size_t size) {
+    const auto *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        auto sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) { return false; }
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool receive_all(int socket, void *data, size_t size) {
+    auto *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        auto received = recv(socket, bytes, size, 0);
+        if (received <= 0) { return false; }
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+class Coordinator {
+public:
+    // Only workers whose scene has scene_identity are served.
+    Coordinator(const Image &_image, Accumulation_buffer &_buffer, std::uint64_t _scene_identity)
+            : image(_image), buffer(_buffer), scene_identity(_scene_identity) {}
+
+    // Serve bands to workers connecting on port until every band is merged into the buffer.
+    bool run(int port);
+
+private:
+    enum class State { Hello, Idle, Busy };
+
+    struct Connection {
+        int socket = -1;
+        State state = State::Hello;
+        int band = -1;
+        std::vector<char> received;
+    };
+
+    const Image &image;
+    Accumulation_buffer &buffer;
+    const std::uint64_t scene_identity;
+    std::deque<int> pending;
+    int completed = 0;
+    unsigned long long ray_count = 0;
+
+    [[nodiscard]] size_t band_value_count(int band) const {
+        return 3 * size_t(buffer.band_rows(band)) * buffer.width;
+    }
+
+    // Consume what has arrived on a connection; false when it must be dropped.
+    bool process(Connection &connection);
+
+    void drop(Connection &connection);
+};
+
+bool Coordinator::run(int port) {
+    int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "ERROR: Could not create coordinator socket.\n";
+        return false;
+    }
+
+    int yes = 1;
+    int no = 0;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(static_cast<std::uint16_t>(port));
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "ERROR: Could not listen on port " << port << ".\n";
+        close(listener);
+        return false;
+    }
+
+    for (int band = 0; band < buffer.band_count(); ++band) { pending.push_back(band); }
+    std::cerr << "coordinator: listening on port " << port << " for " << buffer.band_count() << " bands\n";
+
+    std::vector<Connection> connections;
+    while (completed < buffer.band_count()) {
+        // Hand pending bands to idle workers.
+        for (auto &connection: connections) {
+            if (connection.state != State::Idle || pending.empty()) { continue; }
+
+            std::int32_t band = pending.front();
+            if (!send_all(connection.socket, &band, sizeof(band))) {
+                drop(connection);
+                continue;
+            }
+            pending.pop_front();
+            connection.band = band;
+            connection.state = State::Busy;
+        }
+
+        std::erase_if(connections, [](const Connection &connection) { return connection.socket < 0; });
+
+        std::vector<pollfd> descriptors = {{listener, POLLIN, 0}};
+        for (const auto &connection: connections) { descriptors.push_back({connection.socket, POLLIN, 0}); }
+
+        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            if (errno == EINTR) { continue; }
+            std::cerr << "ERROR: poll failed in the coordinator.\n";
+            break;
+        }
+
+        for (size_t i = 1; i < descriptors.size(); ++i) {
+            if (descriptors[i].revents != 0 && !process(connections[i - 1])) { drop(connections[i - 1]); }
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            int worker = accept(listener, nullptr, nullptr);
+            if (worker >= 0) {
+                fcntl(worker, F_SETFL, fcntl(worker, F_GETFL) | O_NONBLOCK);
+                Connection connection;
+                connection.socket = worker;
+                connections.push_back(std::move(connection));
+            }
+        }
+    }
+
+    for (auto &connection: connections) {
+        if (connection.socket < 0) { continue; }
+        std::int32_t done = -1;
+        if (connection.state == State::Idle) { send_all(connection.socket, &done, sizeof(done)); }
+        close(connection.socket);
+    }
+    close(listener);
+
+    std::cerr << "\ncoordinator: merged " << completed << " bands, " << ray_count << " rays\n";
+    return completed == buffer.band_count();
+}
+
+bool Coordinator::process(Coordinator::Connection &connection) {
+    char chunk[1 << 16];
+    auto size = recv(connection.socket, chunk, sizeof(chunk), 0);
+    if (size == 0 || (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) { return false; }
+    if (size > 0) { connection.received.insert(connection.received.end(), chunk, chunk + size); }
+
+    if (connection.state == State::Hello) {
+        if (connection.received.size() < sizeof(Worker_hello)) { return true; }
+
+        Worker_hello hello{};
+        std::memcpy(&hello, connection.received.data(), sizeof(hello));
+        auto expected = make_worker_hello(image, scene_identity);
+        if (std::memcmp(&hello, &expected, sizeof(hello)) != 0) {
+            std::cerr << "coordinator: rejected a worker rendering a different scene or different image settings\n";
+            return false;
+        }
+
+        connection.received.erase(connection.received.begin(), connection.received.begin() + sizeof(hello));
+        connection.state = State::Idle;
+    }
+
+    if (connection.state != State::Busy || connection.received.size() < sizeof(Band_result_header)) { return true; }
+
+    Band_result_header header{};
+    std::memcpy(&header, connection.received.data(), sizeof(header));
+    if (header.band != connection.band || header.value_count != band_value_count(connection.band)) { return false; }
+
+    auto message_size = sizeof(header) + header.value_count * sizeof(float);
+    if (connection.received.size() < message_size) { return true; }
+
+    std::memcpy(buffer.band_sums(connection.band), connection.received.data() + sizeof(header),
+                header.value_count * sizeof(float));
+    std::fill_n(buffer.band_counts(connection.band), header.value_count / 3, image.sample_per_pixel);
+
+    connection.received.erase(connection.received.begin(), connection.received.begin() + message_size);
+    connection.state = State::Idle;
+    connection.band = -1;
+    ray_count += header.rays;
+    ++completed;
+
+    std::cerr << "\rcoordinator: " << completed << '/' << buffer.band_count() << " bands" << std::flush;
+    return true;
+}
+
+void Coordinator::drop(Coordinator::Connection &connection) {
+    if (connection.state == State::Busy) {
+        std::cerr << "\ncoordinator: lost the worker rendering band " << connection.band << ", requeueing it\n";
+        pending.push_front(connection.band);
+    }
+    close(connection.socket);
+    connection.socket = -1;
+}
+
+inline int connect_to(const std::string &host, const std::string &port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) { return -1; }
+
+    int connection = -1;
+    for (auto *address = addresses; address != nullptr && connection < 0; address = address->ai_next) {
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) != 0) {
+            close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    return connection;
+}
+
+// Render bands for the coordinator at host:port, one connection per render thread, until it runs out of work.
+bool run_worker(const std::string &coordinator, const Image &image, const Scene &scene) {
+    auto colon = coordinator.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "ERROR: Expected the coordinator as host:port, got '" << coordinator << "'.\n";
+        return false;
+    }
+    auto host = coordinator.substr(0, colon);
+    auto port = coordinator.substr(colon + 1);
+
+    Accumulation_buffer buffer(image);
+    std::atomic<int> failures{0};
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < image.threads(); ++i) {
+        threads.emplace_back([&]() {
+            int connection = connect_to(host, port);
+            if (connection < 0) {
+                std::cerr << "ERROR: Could not connect to coordinator '" << coordinator << "'.\n";
+                ++failures;
+                return;
+            }
+
+            auto hello = make_worker_hello(image, scene.identity);
+            std::int32_t band;
+            bool answered = false;      // a coordinator that rejects the hello just closes the connection
+            bool ok = send_all(connection, &hello, sizeof(hello));
+            while (ok && receive_all(connection, &band, sizeof(band))) {
+                answered = true;
+                if (band < 0 || band >= buffer.band_count()) { break; }
+
+                rays_traced = 0;
+                render_band(image, scene, buffer, band, image.sample_per_pixel);
+
+                auto value_count = 3 * buffer.band_rows(band) * buffer.width;
+                Band_result_header header{band, static_cast<std::uint32_t>(value_count), rays_traced};
+
+                ok = send_all(connection, &header, sizeof(header)) &&
+                     send_all(connection, buffer.band_sums(band), header.value_count * sizeof(float));
+            }
+            close(connection);
+
+            if (!answered) {
+                std::cerr << "ERROR: Coordinator '" << coordinator << "' closed the connection; it renders a different "
+                          << "scene or different image settings.\n";
+                ++failures;
+            }
+        });
+    }
+
+    for (auto &thread: threads) { thread.join(); }
+    return failures == 0;
+}
+
+#endif //RAY_TRACING_IN_CPP_DISTRIBUTED_H
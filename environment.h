@@ -0,0 +1,165 @@
+#ifndef RAY_TRACING_IN_CPP_ENVIRONMENT_H
+#define RAY_TRACING_IN_CPP_ENVIRONMENT_H
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "util.h"
+#include "rtw_stb_image.h"
+
+#include "Sphere.h"
+
+// Radiance arriving from every direction, as an equirectangular image mapped the way Sphere::get_sphere_uv maps a
+// sphere (u around the Y axis from X=-1, v up from Y=-1), rows stored top first. Texels are single precision floats
+// in one row-major array and each row's CDF is one contiguous run, so both a lookup and a sample only touch a few
+// neighbouring cache lines. Sampling picks texels in proportion to their luminance times the solid angle they cover,
+// so a small, bright sun is found by every sample instead of by the odd scattered ray.
+class Environment_map {
+public:
+    Environment_map() = default;
+
+    // Load an image through stb_image as linear float radiance (HDR files as they are, others converted from sRGB),
+    // multiplied by scale.
+    static bool load(const char *filename, double scale, Environment_map &map);
+
+    // Build from width * height RGB triples, top row first.
+    void build(const float *rgb, int _width, int _height, double scale);
+
+    [[nodiscard]] Color radiance(const Vec3 &direction) const;
+
+    // Choose a direction in proportion to the radiance arriving from it; pdf is per unit solid angle. False when the
+    // map is black.
+    bool sample(Vec3 &direction, Color &value, double &pdf) const;
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<float> texels;          // three per texel
+    std::vector<float> row_cdfs;        // width + 1 per row
+    std::vector<float> marginal_cdf;    // height + 1, over rows
+    double weight_mean = 0.0;           // of the sampling weights, over all texels
+
+    [[nodiscard]] Color texel(int row, int column) const {
+        auto index = 3 * (size_t(row) * width + column);
+        return {texels[index], texels[index + 1], texels[index + 2]};
+    }
+
+    // Luminance times the sine of the polar angle at the row's center, which the texel's solid angle follows.
+    [[nodiscard]] double weight(int row, int column) const {
+        auto radiance = texel(row, column);
+        auto sin_theta = std::sin(pi * (row + 0.5) / height);
+        return (0.2126 * radiance.x() + 0.7152 * radiance.y() + 0.0722 * radiance.z()) * sin_theta;
+    }
+};
+
+// Index of the interval of cdf (count + 1 increasing values from 0 to 1) holding u, and u's offset within it.
+inline int sample_cdf(const float *cdf, int count, double u, double &offset) {
+    auto index = static_cast<int>(std::upper_bound(cdf, cdf + count + 1, static_cast<float>(u)) - cdf) - 1;
+    index = std::clamp(index, 0, count - 1);
+
+    // Empty intervals are never chosen, but keep the offset in range if rounding lands in one.
+    auto width = cdf[index + 1] - cdf[index];
+    offset = width > 0 ? std::clamp((u - cdf[index]) / width, 0.0, 1.0) : 0.5;
+    return index;
+}
+
+bool Environment_map::load(const char *filename, double scale, Environment_map &map) {
+    int image_width = 0;
+    int image_height = 0;
+    int components = 0;
+    float *data = stbi_loadf(filename, &image_width, &image_height, &components, 3);
+    if (data == nullptr) {
+        std::cerr << "ERROR: Could not load environment map '" << filename << "'.\n";
+        return false;
+    }
+
+    map.build(data, image_width, image_height, scale);
+    stbi_image_free(data);
+    return true;
+}
+
+void Environment_map::build(const float *rgb, int _width, int _height, double scale) {
+    width = _width;
+    height = _height;
+    texels.resize(3 * size_t(width) * height);
+    for (size_t i = 0; i < texels.size(); ++i) {
+        texels[i] = std::max(0.0f, static_cast<float>(rgb[i] * scale));
+    }
+
+    // Accumulate in double precision, store normalized in single.
+    row_cdfs.assign(size_t(width + 1) * height, 0.0f);
+    marginal_cdf.assign(height + 1, 0.0f);
+    std::vector<double> row_sums(height, 0.0);
+    std::vector<double> running(width + 1);
+    double total = 0;
+    for (int row = 0; row < height; ++row) {
+        running[0] = 0;
+        for (int column = 0; column < width; ++column) { running[column + 1] = running[column] + weight(row, column); }
+
+        auto *cdf = &row_cdfs[size_t(width + 1) * row];
+        row_sums[row] = running[width];
+        for (int column = 0; column <= width; ++column) {
+            cdf[column] = row_sums[row] > 0 ? static_cast<float>(running[column] / row_sums[row])
+                                            : static_cast<float>(column) / width;
+        }
+        total += row_sums[row];
+    }
+
+    double sum = 0;
+    for (int row = 0; row < height; ++row) {
+        sum += row_sums[row];
+        marginal_cdf[row + 1] = total > 0 ? static_cast<float>(sum / total) : 0.0f;
+    }
+    if (total > 0) { marginal_cdf[height] = 1.0f; }
+
+    weight_mean = total / (double(width) * height);
+}
+
+Color Environment_map::radiance(const Vec3 &direction) const {
+    if (texels.empty()) { return {0, 0, 0}; }
+
+    double u;
+    double v;
+    Sphere::get_sphere_uv(unit_vector(direction), u, v);
+    auto column = std::clamp(static_cast<int>(u * width), 0, width - 1);
+    auto row = std::clamp(static_cast<int>((1 - v) * height), 0, height - 1);
+    return texel(row, column);
+}
+
+bool Environment_map::sample(Vec3 &direction, Color &value, double &pdf) const {
+    if (weight_mean <= 0) { return false; }
+
+    double row_offset;
+    double column_offset;
+    auto row = sample_cdf(marginal_cdf.data(), height, random_double(), row_offset);
+    auto column = sample_cdf(&row_cdfs[size_t(width + 1) * row], width, random_double(), column_offset);
+
+    auto u = (column + column_offset) / width;
+    auto v = 1 - (row + row_offset) / height;
+    auto sin_theta = std::sin(v * pi);
+    if (sin_theta <= 0) { return false; }
+    direction = unit_sphere_point(u, v);
+
+    // Uniform over the texel in (u, v), which covers 2 pi^2 sin(theta) of solid angle per unit area there.
+    pdf = weight(row, column) / weight_mean / (2 * pi * pi * sin_theta);
+    value = texel(row, column);
+    return pdf > 0;
+}
+
+// What a ray leaving the scene sees: a constant color, or an environment map when there is one. A color converts to
+// a plain background.
+struct Background {
+    Color color;
+    std::shared_ptr<const Environment_map> environment;
+    bool sampled = false;               // the environment is sampled directly, see build_lights
+
+    Background(const Color &_color = Color(0, 0, 0)) : color(_color) {}
+
+    [[nodiscard]] Color value(const Vec3 &direction) const {
+        return environment ? environment->radiance(direction) : color;
+    }
+};
+
+#endif //RAY_TRACING_IN_CPP_ENVIRONMENT_H
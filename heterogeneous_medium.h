@@ -0,0 +1,238 @@
+#ifndef RAY_TRACING_IN_CPP_HETEROGENEOUS_MEDIUM_H
+#define RAY_TRACING_IN_CPP_HETEROGENEOUS_MEDIUM_H
+
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+#include "Hittable.h"
+#include "Material.h"
+#include "Texture.h"
+
+// Spatially varying extinction coefficient of a participating medium.
+class Density_field {
+public:
+    virtual ~Density_field() = default;
+
+    [[nodiscard]] virtual double density(const Point3 &point) const = 0;
+
+    // A bound no density query can exceed.
+    [[nodiscard]] virtual double upper_bound() const = 0;
+
+    // A bound no density query inside box can exceed; the global one unless the field can do better.
+    [[nodiscard]] virtual double region_bound([[maybe_unused]] const AABB &box) const { return upper_bound(); }
+};
+
+// Density read from a texture, e.g. a Noise_texture: the mean of its channels scaled by max_density.
+class Texture_density : public Density_field {
+public:
+    shared_ptr<Texture> texture;
+    double max_density;
+
+    Texture_density(shared_ptr<Texture> _texture, double _max_density)
+            : texture(std::move(_texture)), max_density(_max_density) {}
+
+    [[nodiscard]] double density(const Point3 &point) const override {
+        auto color = texture->value(0, 0, point);
+        return max_density * (color.x() + color.y() + color.z()) / 3.0;
+    }
+
+    // Only exact for textures in [0, 1], which every procedural texture here is.
+    [[nodiscard]] double upper_bound() const override { return max_density; }
+};
+
+// Coarse grid of per-cell density bounds used as the majorant for delta tracking. Each cell takes the field's own
+// bound over it (see Density_field::region_bound), so delta tracking stays unbiased; fields that can bound regions
+// tightly make empty cells cost nothing.
+class Majorant_grid {
+public:
+    AABB bounds;
+    int resolution = 0;
+    Vec3 cell_size;
+    std::vector<double> majorants;
+
+    Majorant_grid() = default;
+
+    Majorant_grid(const Density_field &field, const AABB &_bounds, int _resolution);
+
+    [[nodiscard]] double majorant(int x, int y, int z) const {
+        return majorants[(z * resolution + y) * resolution + x];
+    }
+};
+
+Majorant_grid::Majorant_grid(const Density_field &field, const AABB &_bounds, int _resolution)
+        : bounds(_bounds), resolution(_resolution),
+          cell_size((_bounds.max() - _bounds.min()) / _resolution),
+          majorants(_resolution * _resolution * _resolution, 0.0) {
+    for (int z = 0; z < resolution; ++z) {
+        for (int y = 0; y < resolution; ++y) {
+            for (int x = 0; x < resolution; ++x) {
+                auto cell_min = bounds.min() + Vec3(x * cell_size.x(), y * cell_size.y(), z * cell_size.z());
+                auto cell = AABB(cell_min, cell_min + cell_size);
+                majorants[(z * resolution + y) * resolution + x] = field.region_bound(cell);
+            }
+        }
+    }
+}
+
+// Incremental 3D DDA over the cells of a regular grid, starting in the cell that contains ray.at(t_start).
+class Grid_dda {
+public:
+    int cell[3];
+
+    Grid_dda(const Ray &ray, double t_start, const Point3 &grid_min, const Vec3 &cell_size, const int resolution[3]);
+
+    // Distance at which the ray leaves the current cell.
+    [[nodiscard]] double cell_exit() const { return next_t[exit_axis()]; }
+
+    // Step into the next cell along the ray; false once the ray leaves the grid.
+    bool advance();
+
+private:
+    int step[3];
+    int size[3];
+    double next_t[3];
+    double delta_t[3];
+
+    [[nodiscard]] int exit_axis() const {
+        return next_t[0] < next_t[1] ? (next_t[0] < next_t[2] ? 0 : 2) : (next_t[1] < next_t[2] ? 1 : 2);
+    }
+};
+
+Grid_dda::Grid_dda(const Ray &ray, double t_start, const Point3 &grid_min, const Vec3 &cell_size,
+                   const int resolution[3]) {
+    const auto &direction = ray._direction;
+    const auto start = ray.at(t_start);
+
+    for (int a = 0; a < 3; ++a) {
+        size[a] = resolution[a];
+
+        auto offset = (start[a] - grid_min[a]) / cell_size[a];
+        cell[a] = static_cast<int>(clamp(floor(offset), 0, size[a] - 1));
+
+        if (direction[a] > 0) {
+            step[a] = 1;
+            next_t[a] = t_start + (grid_min[a] + (cell[a] + 1) * cell_size[a] - start[a]) / direction[a];
+            delta_t[a] = cell_size[a] / direction[a];
+        } else if (direction[a] < 0) {
+            step[a] = -1;
+            next_t[a] = t_start + (grid_min[a] + cell[a] * cell_size[a] - start[a]) / direction[a];
+            delta_t[a] = -cell_size[a] / direction[a];
+        } else {
+            step[a] = 0;
+            next_t[a] = infinity;
+            delta_t[a] = infinity;
+        }
+    }
+}
+
+bool Grid_dda::advance() {
+    auto axis = exit_axis();
+
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= size[axis]) { return false; }
+    next_t[axis] += delta_t[axis];
+
+    return true;
+}
+
+// A participating medium whose density varies inside a convex boundary, sampled with delta tracking.
+// Free flights are drawn against the majorant of each grid cell the ray crosses and accepted with probability
+// density / majorant, so the medium is unbiased wherever the majorant grid bounds the field.
+class Heterogeneous_medium : public Hittable {
+public:
+    shared_ptr<Hittable> boundary;
+    shared_ptr<Density_field> field;
+    shared_ptr<Material> phase_function;
+    Majorant_grid grid;
+
+    Heterogeneous_medium(shared_ptr<Hittable> _boundary, shared_ptr<Density_field> _field,
+                         const shared_ptr<Texture> &texture, int grid_resolution = 8)
+            : boundary(std::move(_boundary)), field(std::move(_field)),
+              phase_function(make_shared<Isotropic>(texture)) {
+        build_grid(grid_resolution);
+    }
+
+    Heterogeneous_medium(shared_ptr<Hittable> _boundary, shared_ptr<Density_field> _field, Color color,
+                         int grid_resolution = 8)
+            : boundary(std::move(_boundary)), field(std::move(_field)),
+              phase_function(make_shared<Isotropic>(color)) {
+        build_grid(grid_resolution);
+    }
+
+    bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
+
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override {
+        rec.point = ray.at(rec.t);
+        rec.normal = Vec3(1, 0, 0); // arbitrary
+        rec.front_face = true;  // also arbitrary
+        rec.material_ptr = phase_function.get();
+    }
+
+    bool bounding_box(double time0, double time1, AABB &output_box) const override {
+        return boundary->bounding_box(time0, time1, output_box);
+    }
+
+    bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const override {
+        return boundary->motion_bounds(time0, time1, box0, box1);
+    }
+
+    // The grid follows the boundary to the new interval.
+    void refit(double time0, double time1) override {
+        boundary->refit(time0, time1);
+        build_grid(grid.resolution, time0, time1);
+    }
+
+private:
+    void build_grid(int grid_resolution, double time0 = 0, double time1 = 1) {
+        AABB bounds;
+        if (!boundary->bounding_box(time0, time1, bounds)) {
+            std::cerr << "No bounding box for heterogeneous medium boundary.\n";
+        }
+        grid = Majorant_grid(*field, bounds, grid_resolution);
+    }
+};
+
+bool Heterogeneous_medium::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Heterogeneous_medium);
+
+    double t_enter;
+    double t_exit;
+
+    if (!boundary->boundary_interval(ray, t_enter, t_exit)) { return false; }
+
+    if (t_enter < t_min) { t_enter = t_min; }
+    if (t_exit > t_max) { t_exit = t_max; }
+    if (t_enter < 0) { t_enter = 0; }
+
+    if (t_enter >= t_exit) { return false; }
+
+    const auto ray_length = ray.direction().length();
+    const int resolution[3] = {grid.resolution, grid.resolution, grid.resolution};
+    Grid_dda dda(ray, t_enter, grid.bounds.min(), grid.cell_size, resolution);
+
+    auto t = t_enter;
+    while (t < t_exit) {
+        auto cell_exit = fmin(dda.cell_exit(), t_exit);
+
+        if (auto majorant = grid.majorant(dda.cell[0], dda.cell[1], dda.cell[2]); majorant > 0) {
+            while (true) {
+                t -= log(1.0 - random_double()) / (majorant * ray_length);
+                if (t >= cell_exit) { break; }
+
+                if (random_double() * majorant < field->density(ray.at(t))) {
+                    rec.set_hit(t, this);
+                    return true;
+                }
+            }
+        }
+
+        t = cell_exit;
+        if (!dda.advance()) { break; }
+    }
+
+    return false;
+}
+
+#endif //RAY_TRACING_IN_CPP_HETEROGENEOUS_MEDIUM_H
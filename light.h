@@ -0,0 +1,229 @@
+#ifndef RAY_TRACING_IN_CPP_LIGHT_H
+#define RAY_TRACING_IN_CPP_LIGHT_H
+
+#include <unordered_set>
+#include <vector>
+
+#include "util.h"
+
+#include "aabb.h"
+#include "Material.h"
+
+// What the light BVH knows about a group of emitters: where they are, how much power they emit and in which
+// directions. Every surface normal of the group lies within acos(cos_theta_o) of axis, or of -axis too for two-sided
+// emitters, and each point emits over the hemisphere about its normal.
+struct Light_bounds {
+    AABB box;
+    double power = 0.0;
+    Vec3 axis = Vec3(0, 0, 1);
+    double cos_theta_o = 1.0;
+    bool two_sided = false;
+
+    // Conservative estimate of the group's contribution at point, whose surface faces normal; a zero normal (a point
+    // in a volume) scatters in every direction. Zero only when no emitter of the group can light the point.
+    [[nodiscard]] double importance(const Point3 &point, const Vec3 &normal) const;
+};
+
+// cos(theta_a - theta_b), or 1 when theta_a is the smaller angle.
+inline double cos_subtract_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+    return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin(theta_a - theta_b), or 0 when theta_a is the smaller angle.
+inline double sin_subtract_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+    return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+inline double safe_sqrt(double x) { return std::sqrt(std::max(0.0, x)); }
+
+double Light_bounds::importance(const Point3 &point, const Vec3 &normal) const {
+    auto center = 0.5 * (box.minimum + box.maximum);
+    auto radius_squared = 0.25 * (box.maximum - box.minimum).length_squared();
+    auto to_point = point - center;
+    auto distance_squared = to_point.length_squared();
+
+    // Directions from the point into the group's bounding sphere lie within theta_b of the one to its center.
+    auto cos_theta_b = distance_squared > radius_squared ? safe_sqrt(1 - radius_squared / distance_squared) : -1.0;
+    auto sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+    // Smallest angle between an emitter normal and the direction to the point, over the whole group.
+    auto from_light = distance_squared > 0 ? to_point / std::sqrt(distance_squared) : Vec3(0, 0, 1);
+    auto cos_theta_w = dot(axis, from_light);
+    if (two_sided) { cos_theta_w = std::abs(cos_theta_w); }
+    auto sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+    auto sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+    auto cos_theta_x = cos_subtract_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    auto sin_theta_x = sin_subtract_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    auto cos_theta_emit = cos_subtract_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_emit <= 0) { return 0.0; }
+
+    auto importance = power * cos_theta_emit / std::max(distance_squared, radius_squared);
+
+    if (!normal.near_zero()) {
+        auto cos_theta_i = -dot(from_light, normal);
+        auto sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+        importance *= std::max(0.0, cos_subtract_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b));
+    }
+
+    return importance;
+}
+
+// Bounds of two groups together. The merged cone is the smallest one holding both; two-sided cones may be flipped
+// to get there.
+inline Light_bounds merge(const Light_bounds &a, const Light_bounds &b) {
+    if (a.power <= 0) { return b; }
+    if (b.power <= 0) { return a; }
+
+    Light_bounds merged;
+    merged.box = surrounding_box(a.box, b.box);
+    merged.power = a.power + b.power;
+    merged.two_sided = a.two_sided || b.two_sided;
+
+    auto b_axis = a.two_sided && b.two_sided && dot(a.axis, b.axis) < 0 ? -b.axis : b.axis;
+    auto theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0, 1.0));
+    auto theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+    auto theta_d = std::acos(std::clamp(dot(a.axis, b_axis), -1.0, 1.0));
+
+    if (std::min(theta_d + theta_b, pi) <= theta_a) {
+        merged.axis = a.axis;
+        merged.cos_theta_o = a.cos_theta_o;
+        return merged;
+    }
+    if (std::min(theta_d + theta_a, pi) <= theta_b) {
+        merged.axis = b_axis;
+        merged.cos_theta_o = b.cos_theta_o;
+        return merged;
+    }
+
+    auto theta_o = (theta_a + theta_d + theta_b) / 2;
+    auto rotation_axis = cross(a.axis, b_axis);
+    if (theta_o >= pi || rotation_axis.near_zero()) {
+        merged.cos_theta_o = -1.0;
+        return merged;
+    }
+
+    // Turn a's axis toward b's until the cone reaches both.
+    auto theta_r = theta_o - theta_a;
+    auto k = unit_vector(rotation_axis);
+    merged.axis = a.axis * std::cos(theta_r) + cross(k, a.axis) * std::sin(theta_r) +
+                  k * dot(k, a.axis) * (1 - std::cos(theta_r));
+    merged.cos_theta_o = std::cos(theta_o);
+    return merged;
+}
+
+enum class Light_shape {
+    rectangle, sphere
+};
+
+// An emitter that can be sampled directly, in world space: a rectangle spanned by edge_u and edge_v from corner, or
+// a sphere, lit by a Diffuse_light.
+struct Light {
+    Light_shape shape = Light_shape::rectangle;
+    Point3 corner;
+    Vec3 edge_u;
+    Vec3 edge_v;
+    Point3 center;
+    double radius = 0.0;
+    const Diffuse_light *material = nullptr;
+    Light_bounds bounds;
+};
+
+// Gathers a scene's lights through Hittable::collect_lights. A Diffuse_light also used by something that can't be
+// sampled (a rotated instance, a box, a moving sphere, ...) is left out altogether, since its emission must then
+// still be found by scattering.
+class Light_collector {
+public:
+    void add_rectangle(const Point3 &corner, const Vec3 &edge_u, const Vec3 &edge_v,
+                       const shared_ptr<Material> &material, bool sampleable);
+
+    void add_sphere(const Point3 &center, double radius, const shared_ptr<Material> &material, bool sampleable);
+
+    void exclude(const shared_ptr<Material> &material) { excluded.insert(material.get()); }
+
+    // The lights to sample; their materials are marked as sampled (see Material::sampled_light).
+    std::vector<Light> finish();
+
+private:
+    std::vector<Light> lights;
+    std::vector<Diffuse_light *> emitters;      // of each light
+    std::unordered_set<const Material *> excluded;
+};
+
+// Mean emission over a grid of texture coordinates, point_at mapping them onto the surface. Kept above zero, so
+// that a light whose texture happens to be dark at the grid points is still chosen now and then.
+template<typename Point_at>
+double mean_emission(const Diffuse_light &emitter, Point_at &&point_at) {
+    const int steps = 4;
+    double sum = 0;
+    for (int i = 0; i < steps; ++i) {
+        for (int j = 0; j < steps; ++j) {
+            auto u = (i + 0.5) / steps;
+            auto v = (j + 0.5) / steps;
+            auto emitted = emitter.emitted(u, v, point_at(u, v));
+            sum += (emitted.x() + emitted.y() + emitted.z()) / 3;
+        }
+    }
+    return std::max(sum / (steps * steps), 1e-9);
+}
+
+void Light_collector::add_rectangle(const Point3 &corner, const Vec3 &edge_u, const Vec3 &edge_v,
+                                    const shared_ptr<Material> &material, bool sampleable) {
+    auto *emitter = dynamic_cast<Diffuse_light *>(material.get());
+    if (emitter == nullptr) { return; }
+    if (!sampleable) { return exclude(material); }
+
+    auto far_corner = corner + edge_u + edge_v;
+    auto normal = cross(edge_u, edge_v);
+    auto emission = mean_emission(*emitter, [&](double u, double v) { return corner + u * edge_u + v * edge_v; });
+
+    Light light;
+    light.shape = Light_shape::rectangle;
+    light.corner = corner;
+    light.edge_u = edge_u;
+    light.edge_v = edge_v;
+    light.material = emitter;
+    light.bounds.box = surrounding_box(AABB(corner, corner), AABB(far_corner, far_corner));
+    light.bounds.power = 2 * normal.length() * emission;   // Diffuse_light emits from both faces
+    light.bounds.axis = unit_vector(normal);
+    light.bounds.cos_theta_o = 1.0;
+    light.bounds.two_sided = true;
+
+    lights.push_back(light);
+    emitters.push_back(emitter);
+}
+
+void Light_collector::add_sphere(const Point3 &center, double radius, const shared_ptr<Material> &material,
+                                 bool sampleable) {
+    auto *emitter = dynamic_cast<Diffuse_light *>(material.get());
+    if (emitter == nullptr) { return; }
+    if (!sampleable) { return exclude(material); }
+
+    auto emission = mean_emission(*emitter, [&](double u, double v) {
+        return center + radius * unit_sphere_point(u, v);
+    });
+    auto extent = Vec3(radius, radius, radius);
+
+    Light light;
+    light.shape = Light_shape::sphere;
+    light.center = center;
+    light.radius = radius;
+    light.material = emitter;
+    light.bounds.box = AABB(center - extent, center + extent);
+    light.bounds.power = 4 * pi * radius * radius * emission;
+    light.bounds.cos_theta_o = -1.0;
+
+    lights.push_back(light);
+    emitters.push_back(emitter);
+}
+
+std::vector<Light> Light_collector::finish() {
+    std::vector<Light> sampled;
+    for (size_t i = 0; i < lights.size(); ++i) {
+        if (excluded.contains(emitters[i])) { continue; }
+        emitters[i]->sampled = true;
+        sampled.push_back(lights[i]);
+    }
+    return sampled;
+}
+
+#endif //RAY_TRACING_IN_CPP_LIGHT_H
@@ -0,0 +1,231 @@
+#ifndef RAY_TRACING_IN_CPP_LIGHT_BVH_H
+#define RAY_TRACING_IN_CPP_LIGHT_BVH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+
+#include "light.h"
+#include "Sphere.h"
+
+// A point on a light seen from a shading point, with its emission toward that point and the probability density of
+// having picked it, per unit solid angle there.
+struct Light_sample {
+    Point3 point;
+    Color radiance;
+    double pdf = 0.0;
+};
+
+// Sample light as seen from point: rectangles uniformly by area, spheres uniformly over the cone they subtend (by
+// area when the point is inside). False when the light can't be seen from the point at all.
+bool sample_light(const Light &light, const Point3 &point, Light_sample &sample) {
+    if (light.shape == Light_shape::rectangle) {
+        auto u = random_double();
+        auto v = random_double();
+        sample.point = light.corner + u * light.edge_u + v * light.edge_v;
+
+        auto normal = cross(light.edge_u, light.edge_v);
+        auto to_light = sample.point - point;
+        auto distance_squared = to_light.length_squared();
+        auto cosine_area = std::abs(dot(normal, to_light)) / std::sqrt(distance_squared);
+        if (cosine_area <= 0) { return false; }
+
+        sample.pdf = distance_squared / cosine_area;
+        sample.radiance = light.material->emitted(u, v, sample.point);
+        return true;
+    }
+
+    auto to_center = light.center - point;
+    auto distance_squared = to_center.length_squared();
+    auto radius_squared = light.radius * light.radius;
+
+    if (distance_squared <= radius_squared) {
+        auto normal = random_unit_vector();
+        sample.point = light.center + light.radius * normal;
+
+        auto to_light = sample.point - point;
+        auto cosine = std::abs(dot(normal, unit_vector(to_light)));
+        if (cosine <= 0) { return false; }
+        sample.pdf = to_light.length_squared() / (cosine * 4 * pi * radius_squared);
+    } else {
+        // 1 - cos_theta_max written so it stays accurate for small, distant spheres.
+        auto sin_squared_max = radius_squared / distance_squared;
+        auto cos_theta_max = std::sqrt(1 - sin_squared_max);
+        auto one_minus_cos_max = sin_squared_max / (1 + cos_theta_max);
+
+        auto cos_theta = 1 - random_double() * one_minus_cos_max;
+        auto sin_theta = std::sqrt(std::max(0.0, 1 - cos_theta * cos_theta));
+        auto phi = 2 * pi * random_double();
+
+        auto w = to_center / std::sqrt(distance_squared);
+        auto a = std::abs(w.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+        auto v = unit_vector(cross(w, a));
+        auto u = cross(w, v);
+        auto direction = sin_theta * cos(phi) * u + sin_theta * sin(phi) * v + cos_theta * w;
+
+        // Nearest intersection with the sphere along the sampled direction.
+        auto half_b = dot(direction, to_center);
+        auto s = half_b - std::sqrt(std::max(0.0, half_b * half_b - (distance_squared - radius_squared)));
+        sample.point = point + s * direction;
+        sample.pdf = 1 / (2 * pi * one_minus_cos_max);
+    }
+
+    double u;
+    double v;
+    Sphere::get_sphere_uv((sample.point - light.center) / light.radius, u, v);
+    sample.radiance = light.material->emitted(u, v, sample.point);
+    return true;
+}
+
+// Light BVH for scenes with many lights: a binary tree over the lights whose nodes bound their position, power and
+// emission directions (see Light_bounds). A light is chosen for a shading point by walking down from the root,
+// taking each child with probability proportional to its importance there, so distant, dim or facing-away groups of
+// lights are rarely picked however many there are. Built with the surface area orientation heuristic.
+class Light_bvh {
+public:
+    explicit Light_bvh(std::vector<Light> _lights);
+
+    [[nodiscard]] size_t size() const { return lights.size(); }
+
+    // Choose a light for point, on a surface facing normal (zero in a volume); pmf is the probability of the choice.
+    // False when no light can contribute there.
+    bool choose(const Point3 &point, const Vec3 &normal, const Light *&light, double &pmf) const;
+
+private:
+    // Depth first: an interior node's first child follows it, the second is at index.
+    struct Node {
+        Light_bounds bounds;
+        std::uint32_t index = 0;    // light of a leaf, second child of an interior node
+        bool leaf = false;
+    };
+
+    std::vector<Light> lights;
+    std::vector<Node> nodes;
+
+    void build(size_t start, size_t end);
+};
+
+// Surface area orientation heuristic: what a group of lights with these bounds costs inside a node of node_box split
+// along axis. Wide emission cones and boxes stretched across the split cost more.
+inline double light_split_cost(const Light_bounds &bounds, const AABB &node_box, int axis) {
+    auto theta_o = std::acos(std::clamp(bounds.cos_theta_o, -1.0, 1.0));
+    auto theta_w = std::min(theta_o + pi / 2, pi);
+    auto sin_theta_o = std::sqrt(std::max(0.0, 1 - bounds.cos_theta_o * bounds.cos_theta_o));
+    auto orientation = 2 * pi * (1 - bounds.cos_theta_o) +
+                       pi / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) -
+                                 2 * theta_o * sin_theta_o + bounds.cos_theta_o);
+
+    auto extent = node_box.maximum - node_box.minimum;
+    auto longest = std::max({extent.x(), extent.y(), extent.z()});
+    auto regularity = extent[axis] > 0 ? longest / extent[axis] : 1.0;
+
+    return bounds.power * orientation * regularity * bounds.box.surface_area();
+}
+
+Light_bvh::Light_bvh(std::vector<Light> _lights) : lights(std::move(_lights)) {
+    nodes.reserve(2 * lights.size());
+    if (!lights.empty()) { build(0, lights.size()); }
+}
+
+void Light_bvh::build(size_t start, size_t end) {
+    auto node_index = nodes.size();
+    nodes.emplace_back();
+
+    if (end - start == 1) {
+        nodes[node_index] = {lights[start].bounds, static_cast<std::uint32_t>(start), true};
+        return;
+    }
+
+    Light_bounds bounds;
+    Point3 centroid_min(infinity, infinity, infinity);
+    Point3 centroid_max(-infinity, -infinity, -infinity);
+    for (auto i = start; i < end; ++i) {
+        bounds = merge(bounds, lights[i].bounds);
+        auto centroid = 0.5 * (lights[i].bounds.box.minimum + lights[i].bounds.box.maximum);
+        for (int a = 0; a < 3; ++a) {
+            centroid_min[a] = std::min(centroid_min[a], centroid[a]);
+            centroid_max[a] = std::max(centroid_max[a], centroid[a]);
+        }
+    }
+
+    // Cheapest split between buckets of centroids along any axis.
+    const int bucket_count = 12;
+    auto bucket_of = [&](const Light &light, int axis) {
+        auto centroid = 0.5 * (light.bounds.box.minimum[axis] + light.bounds.box.maximum[axis]);
+        auto offset = (centroid - centroid_min[axis]) / (centroid_max[axis] - centroid_min[axis]);
+        return std::min(bucket_count - 1, static_cast<int>(offset * bucket_count));
+    };
+
+    int best_axis = -1;
+    int best_split = 0;
+    auto best_cost = infinity;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (centroid_max[axis] <= centroid_min[axis]) { continue; }
+
+        Light_bounds buckets[bucket_count];
+        for (auto i = start; i < end; ++i) {
+            auto &bucket = buckets[bucket_of(lights[i], axis)];
+            bucket = merge(bucket, lights[i].bounds);
+        }
+
+        for (int split = 0; split < bucket_count - 1; ++split) {
+            Light_bounds below;
+            Light_bounds above;
+            for (int b = 0; b <= split; ++b) { below = merge(below, buckets[b]); }
+            for (int b = split + 1; b < bucket_count; ++b) { above = merge(above, buckets[b]); }
+
+            auto cost = (below.power > 0 ? light_split_cost(below, bounds.box, axis) : 0.0) +
+                        (above.power > 0 ? light_split_cost(above, bounds.box, axis) : 0.0);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    auto mid = start + (end - start) / 2;
+    if (best_axis >= 0) {
+        auto middle = std::partition(lights.begin() + static_cast<std::ptrdiff_t>(start),
+                                     lights.begin() + static_cast<std::ptrdiff_t>(end),
+                                     [&](const Light &light) { return bucket_of(light, best_axis) <= best_split; });
+        auto split = static_cast<size_t>(middle - lights.begin());
+        if (split > start && split < end) { mid = split; }
+    }
+
+    build(start, mid);
+    auto second = nodes.size();
+    build(mid, end);
+    nodes[node_index] = {bounds, static_cast<std::uint32_t>(second), false};
+}
+
+bool Light_bvh::choose(const Point3 &point, const Vec3 &normal, const Light *&light, double &pmf) const {
+    if (nodes.empty()) { return false; }
+
+    // Below the root every node is weighed against its sibling; the root only has to be able to contribute.
+    if (nodes[0].bounds.importance(point, normal) <= 0) { return false; }
+
+    size_t index = 0;
+    pmf = 1;
+    while (!nodes[index].leaf) {
+        auto first = nodes[index + 1].bounds.importance(point, normal);
+        auto second = nodes[nodes[index].index].bounds.importance(point, normal);
+        if (first <= 0 && second <= 0) { return false; }
+
+        auto first_probability = first / (first + second);
+        if (random_double() < first_probability) {
+            index = index + 1;
+            pmf *= first_probability;
+        } else {
+            index = nodes[index].index;
+            pmf *= 1 - first_probability;
+        }
+    }
+
+    light = &lights[nodes[index].index];
+    return true;
+}
+
+#endif //RAY_TRACING_IN_CPP_LIGHT_BVH_H
@@ -0,0 +1,90 @@
+#include "util.h"
+
+#include "checkpoint.h"
+#include "render.h"
+#include "settings.h"
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Combines accumulation files, e.g. the sample ranges written by ray_tracing_in_cpp --sample-range, into one image:
+// sums and sample counts are added per pixel before averaging. The files must come from the same scene and image
+// settings and hold different sample ranges. The image is written as ray_tracing_in_cpp writes it, with the same
+// output options.
+//
+// Usage: ray_tracing_merge [--output FILE] [output options] FILE...
+
+const char *const merge_usage = "Usage: ray_tracing_merge [--output FILE] [output options] FILE...\n\n";
+
+int main(int argc, char **argv) {
+    Output_settings output;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view argument = argv[i];
+        bool ok = true;
+        if (argument == "--help") {
+            std::cerr << merge_usage << output_usage;
+            return 1;
+        } else if (argument.starts_with("--") && i + 1 >= argc) {
+            std::cerr << "Missing value for " << argument << '\n';
+            return 1;
+        } else if (argument.starts_with("--") && parse_output_option(argument, argv[i + 1], output, ok)) {
+            ++i;
+        } else if (argument.starts_with("--")) {
+            std::cerr << "Unknown option " << argument << '\n';
+            return 1;
+        } else {
+            paths.emplace_back(argument);
+        }
+        if (!ok) { return 1; }
+    }
+
+    if (paths.empty()) {
+        std::cerr << merge_usage << output_usage;
+        return 1;
+    }
+    if (!finish_output_settings(output)) { return 1; }
+
+    Accumulation_buffer merged;
+    Checkpoint_header first_header{};
+    std::set<std::pair<unsigned int, unsigned int>> ranges;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        Checkpoint_header header{};
+        Accumulation_buffer buffer;
+        if (!read_accumulation_file(paths[i], header, buffer)) { return 1; }
+
+        if (i == 0) {
+            merged = std::move(buffer);
+            first_header = header;
+        } else if (header.width != first_header.width || header.height != first_header.height ||
+                   header.max_depth != first_header.max_depth) {
+            std::cerr << "ERROR: '" << paths[i] << "' is a " << header.width << 'x' << header.height << " render with "
+                      << "depth " << header.max_depth << ", '" << paths[0] << "' a " << first_header.width << 'x'
+                      << first_header.height << " one with depth " << first_header.max_depth << ".\n";
+            return 1;
+        } else if (header.scene_identity != first_header.scene_identity) {
+            std::cerr << "ERROR: '" << paths[i] << "' renders a different scene or different scene settings than '"
+                      << paths[0] << "'.\n";
+            return 1;
+        } else {
+            for (size_t value = 0; value < merged.sums.size(); ++value) { merged.sums[value] += buffer.sums[value]; }
+            for (size_t pixel = 0; pixel < merged.sample_counts.size(); ++pixel) {
+                merged.sample_counts[pixel] += buffer.sample_counts[pixel];
+            }
+        }
+
+        // The same seed and first sample means the same samples: merging them would count them twice.
+        if (!ranges.emplace(header.seed, header.first_sample).second) {
+            std::cerr << "ERROR: '" << paths[i] << "' repeats seed " << header.seed << " and first sample "
+                      << header.first_sample << " of an earlier file.\n";
+            return 1;
+        }
+    }
+
+    std::cerr << "Merged " << paths.size() << " files, " << merged.completed_samples() << " samples per pixel.\n";
+    return write_image(output.path, merged, output.format, output.post) ? 0 : 1;
+}
@@ -1,8 +1,14 @@
 #ifndef RAY_TRACING_IN_CPP_PERLIN_H
 #define RAY_TRACING_IN_CPP_PERLIN_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "util.h"
 
+using std::vector;
+
 class Perlin {
 public:
     Perlin() {
@@ -61,6 +67,31 @@ public:
         return fabs(accum);
     }
 
+    // turbulence without the octaves that a footprint (the width of a pixel, in noise coordinates) would undersample:
+    // octave i has features 2^-i wide, so it is kept while 2^i * footprint stays below the Nyquist limit of 1/2, the
+    // last one fading out on the way. A zero footprint keeps all depth octaves.
+    [[nodiscard]] double filtered_turbulence(const Point3 &point, double footprint, int depth = 7) const {
+        auto octaves = footprint > 0 ? std::clamp(std::log2(0.5 / footprint), 1.0, double(depth)) : double(depth);
+        auto whole_octaves = static_cast<int>(octaves);
+
+        auto accum = 0.0;
+        auto tmp_point = point;
+        auto weight = 1.0;
+
+        for (int i = 0; i < whole_octaves; i++) {
+            accum += weight * noise(tmp_point);
+            weight *= 0.5;
+            tmp_point *= 2;
+        }
+
+        if (whole_octaves < depth) {
+            auto fraction = std::clamp((octaves - whole_octaves - 0.3) / 0.4, 0.0, 1.0);
+            accum += fraction * fraction * (3 - 2 * fraction) * weight * noise(tmp_point);
+        }
+
+        return fabs(accum);
+    }
+
 private:
     static const int point_count = 256;
     std::vector<Vec3> random_vectors;
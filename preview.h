@@ -0,0 +1,339 @@
+#ifndef RAY_TRACING_IN_CPP_PREVIEW_H
+#define RAY_TRACING_IN_CPP_PREVIEW_H
+
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "distributed.h"
+#include "render.h"
+
+// Interactive preview over HTTP on the loopback interface. A render thread keeps refining the image in short passes
+// and publishes a frame after each one; requests read the latest frame or change the camera or the sample target.
+// A camera change restarts accumulation at the end of the current pass, so the first new frame arrives within two
+// passes of a single sample per pixel. The scene itself is never rebuilt.
+//
+//   GET /                  page showing the image as it refines, with fields for the camera and samples
+//   GET /frame.ppm         the latest frame as binary PPM
+//   GET /frame.bmp         the same as BMP, which browsers display
+//   GET /status            JSON: generation, samples done, sample target and the camera
+//   GET /camera?from=X,Y,Z&at=X,Y,Z&up=X,Y,Z&vfov=D&aperture=A&focus=F     any subset; restarts the image
+//   GET /samples?spp=N     new sample target; the image keeps its samples unless it already has more
+class Preview_server {
+public:
+    // Frames go through post at 8 bits per sample.
+    Preview_server(const Image &_image, Scene &_scene, int _pass_samples, const Post_process &_post = {})
+            : image(_image), scene(_scene), pass_samples(std::max(1, _pass_samples)), post(_post),
+              camera(_scene.camera), sample_target(_image.sample_per_pixel) { post.bits = 8; }
+
+    // Serve previews on 127.0.0.1:port; returns only when the port can't be opened.
+    bool run(int port);
+
+private:
+    struct Frame {
+        std::vector<unsigned char> pixels;  // 8-bit RGB, top row first
+        unsigned int generation = 0;
+        unsigned int samples = 0;
+    };
+
+    Image image;
+    Scene &scene;
+    const int pass_samples;
+    Post_process post;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    Camera camera;              // requested camera, picked up by the render thread
+    bool camera_changed = false;
+    int sample_target;
+    unsigned int generation = 1;
+    Frame frame;
+
+    void render_loop();
+
+    void handle(int client);
+
+    // Apply the query of a /camera or /samples request; false when a value doesn't parse or is out of range.
+    bool update(std::string_view path, std::string_view query);
+
+    std::string status();
+};
+
+// Value of key in a URL query, with %XX escapes decoded; empty when absent.
+inline std::string query_value(std::string_view query, std::string_view key) {
+    while (!query.empty()) {
+        auto end = query.find('&');
+        auto pair = query.substr(0, end);
+        query = end == std::string_view::npos ? std::string_view() : query.substr(end + 1);
+
+        auto equals = pair.find('=');
+        if (equals == std::string_view::npos || pair.substr(0, equals) != key) { continue; }
+
+        std::string value;
+        for (size_t i = equals + 1; i < pair.size(); ++i) {
+            if (pair[i] == '%' && i + 2 < pair.size()) {
+                value += static_cast<char>(std::strtol(std::string(pair.substr(i + 1, 2)).c_str(), nullptr, 16));
+                i += 2;
+            } else {
+                value += pair[i] == '+' ? ' ' : pair[i];
+            }
+        }
+        return value;
+    }
+    return {};
+}
+
+inline bool parse_query_vector(const std::string &text, Vec3 &value) {
+    std::istringstream in(text);
+    char comma1 = 0;
+    char comma2 = 0;
+    in >> value[0] >> comma1 >> value[1] >> comma2 >> value[2];
+    return in && comma1 == ',' && comma2 == ',' &&
+           std::isfinite(value[0]) && std::isfinite(value[1]) && std::isfinite(value[2]);
+}
+
+// A finite number; nan, inf and overflowing values are rejected.
+inline bool parse_query_number(const std::string &text, double &value) {
+    char *end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+bool Preview_server::run(int port) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "ERROR: Could not create preview socket.\n";
+        return false;
+    }
+
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "ERROR: Could not listen on port " << port << ".\n";
+        close(listener);
+        return false;
+    }
+
+    std::cerr << "preview: http://127.0.0.1:" << port << "/\n";
+    std::thread renderer(&Preview_server::render_loop, this);
+    renderer.detach();
+
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) { continue; }
+
+        // Don't let a silent client hold up the others.
+        timeval timeout{2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        handle(client);
+        close(client);
+    }
+}
+
+void Preview_server::render_loop() {
+    Accumulation_buffer buffer;
+    unsigned int rendered_generation = 0;
+
+    while (true) {
+        Image pass_image = image;
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [&]() {
+                return generation != rendered_generation ||
+                       buffer.completed_samples() < static_cast<unsigned int>(sample_target);
+            });
+
+            if (camera_changed || buffer.completed_samples() > static_cast<unsigned int>(sample_target)) {
+                buffer = Accumulation_buffer();
+            }
+            if (camera_changed) {
+                scene.camera = camera;
+                camera_changed = false;
+            }
+            rendered_generation = generation;
+            pass_image.sample_per_pixel = sample_target;
+        }
+
+        if (buffer.sums.empty()) { buffer = Accumulation_buffer(image); }
+
+        // Single-sample passes until the image has some shape, then passes of pass_samples.
+        auto samples = std::clamp(static_cast<int>(buffer.completed_samples()), 1, pass_samples);
+        render_pass(pass_image, scene, buffer, samples);
+
+        auto pixels = frame_pixels(buffer, post);
+        std::lock_guard lock(mutex);
+        frame.pixels = std::move(pixels);
+        frame.generation = rendered_generation;
+        frame.samples = buffer.completed_samples();
+    }
+}
+
+void Preview_server::handle(int client) {
+    std::string request;
+    char chunk[4096];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384) {
+        auto received = recv(client, chunk, sizeof(chunk), 0);
+        if (received <= 0) { return; }
+        request.append(chunk, received);
+    }
+
+    // "GET /path?query HTTP/1.1"
+    auto line_end = request.find("\r\n");
+    if (line_end == std::string::npos) { return; }
+    std::string_view line(request.data(), line_end);
+    auto target_start = line.find(' ') + 1;
+    auto target = line.substr(target_start, line.find(' ', target_start) - target_start);
+    auto question = target.find('?');
+    auto path = target.substr(0, question);
+    auto query = question == std::string_view::npos ? std::string_view() : target.substr(question + 1);
+
+    std::string status_line = "200 OK";
+    std::string content_type = "text/plain";
+    std::string body;
+
+    if (!line.starts_with("GET ")) {
+        status_line = "405 Method Not Allowed";
+        body = "only GET is supported\n";
+    } else if (path == "/") {
+        content_type = "text/html";
+        body = R"(<!DOCTYPE html><title>ray_tracing_in_cpp preview</title>
+<body style="background:#222;color:#ddd;font-family:sans-serif">
+<img id="frame" src="/frame.bmp"><pre id="status"></pre>
+<form id="camera">from <input name="from"> at <input name="at"> vfov <input name="vfov" size="4">
+aperture <input name="aperture" size="4"> focus <input name="focus" size="4"> <button>camera</button></form>
+<form id="samples">samples per pixel <input name="spp" size="6"> <button>samples</button></form>
+<script>
+let shown = "";
+for (const id of ["camera", "samples"]) {
+  document.getElementById(id).onsubmit = (event) => {
+    event.preventDefault();
+    const query = new URLSearchParams([...new FormData(event.target)].filter(([, value]) => value !== ""));
+    fetch("/" + id + "?" + query);
+  };
+}
+async function poll() {
+  try {
+    const status = await (await fetch("/status")).json();
+    document.getElementById("status").textContent = JSON.stringify(status);
+    const key = status.generation + "/" + status.samples;
+    if (key !== shown) {
+      shown = key;
+      document.getElementById("frame").src = "/frame.bmp?" + key;
+    }
+  } catch (error) {}
+  setTimeout(poll, 200);
+}
+poll();
+</script>)";
+    } else if (path == "/frame.ppm" || path == "/frame.bmp") {
+        std::vector<unsigned char> pixels;
+        {
+            std::lock_guard lock(mutex);
+            pixels = frame.pixels;
+        }
+        if (pixels.empty()) {
+            status_line = "503 Service Unavailable";
+            body = "no frame yet\n";
+        } else if (path == "/frame.ppm") {
+            content_type = "image/x-portable-pixmap";
+            body = encode_ppm(pixels, image.width, image.height);
+        } else {
+            content_type = "image/bmp";
+            body = encode_bmp(pixels, image.width, image.height);
+        }
+    } else if (path == "/status") {
+        content_type = "application/json";
+        body = status();
+    } else if (path == "/camera" || path == "/samples") {
+        if (update(path, query)) {
+            body = "ok\n";
+        } else {
+            status_line = "400 Bad Request";
+            body = "bad value in '" + std::string(query) + "'\n";
+        }
+    } else {
+        status_line = "404 Not Found";
+        body = "not found\n";
+    }
+
+    auto response = "HTTP/1.1 " + status_line + "\r\nContent-Type: " + content_type +
+                    "\r\nContent-Length: " + std::to_string(body.size()) +
+                    "\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n" + body;
+    send_all(client, response.data(), response.size());
+}
+
+bool Preview_server::update(std::string_view path, std::string_view query) {
+    std::lock_guard lock(mutex);
+
+    if (path == "/samples") {
+        double spp = 0;
+        if (!parse_query_number(query_value(query, "spp"), spp) || spp < 1 || spp > INT_MAX) { return false; }
+        sample_target = static_cast<int>(spp);
+    } else {
+        auto look_from = camera.origin;
+        auto look_at = camera.target;
+        auto view_up = camera.up;
+        auto field_of_view = camera.field_of_view;
+        auto aperture = 2 * camera.lens_radius;
+        auto focus = camera.focus;
+
+        for (auto [key, vector]: {std::pair{"from", &look_from}, {"at", &look_at}, {"up", &view_up}}) {
+            auto text = query_value(query, key);
+            if (!text.empty() && !parse_query_vector(text, *vector)) { return false; }
+        }
+        for (auto [key, number]: {std::pair{"vfov", &field_of_view}, {"aperture", &aperture}, {"focus", &focus}}) {
+            auto text = query_value(query, key);
+            if (!text.empty() && !parse_query_number(text, *number)) { return false; }
+        }
+        if (field_of_view <= 0 || field_of_view >= 180 || aperture < 0 || focus <= 0 ||
+            (look_at - look_from).near_zero()) {
+            return false;
+        }
+
+        camera = Camera(look_from, look_at, view_up, field_of_view, camera.aspect, aperture, focus,
+                        camera.shutter_open_time, camera.shutter_close_time);
+        camera_changed = true;
+    }
+
+    ++generation;
+    changed.notify_one();
+    return true;
+}
+
+std::string Preview_server::status() {
+    std::lock_guard lock(mutex);
+
+    auto vector = [](const Vec3 &value) {
+        std::ostringstream out;
+        out << '[' << value[0] << ", " << value[1] << ", " << value[2] << ']';
+        return out.str();
+    };
+
+    std::ostringstream out;
+    out << "{\"generation\": " << frame.generation << ", \"samples\": " << frame.samples
+        << ", \"target\": " << sample_target << ", \"from\": " << vector(camera.origin)
+        << ", \"at\": " << vector(camera.target) << ", \"vfov\": " << camera.field_of_view
+        << ", \"aperture\": " << 2 * camera.lens_radius << ", \"focus\": " << camera.focus << "}\n";
+    return out.str();
+}
+
+#endif //RAY_TRACING_IN_CPP_PREVIEW_H
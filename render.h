@@ -0,0 +1,607 @@
+#ifndef RAY_TRACING_IN_CPP_RENDER_H
+#define RAY_TRACING_IN_CPP_RENDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+
+#include "Camera.h"
+#include "Color.h"
+#include "environment.h"
+#include "Hittable.h"
+#include "light_bvh.h"
+#include "Material.h"
+
+// Rays traced by the current thread, read back by the jobs for throughput reports.
+thread_local unsigned long long rays_traced = 0;
+
+// Light reaching the viewer from a hit through one light chosen by the light BVH, or through the sampled environment
+// (each half the time when there are both), or nothing when something is in the way. The shadow ray counts as a
+// traced ray.
+Color sample_direct_light(const Ray &ray, const Hit_record &record, const Hittable &world, const Light_bvh *lights,
+                          const Background &background) {
+    auto choice = lights != nullptr && background.sampled ? 0.5 : 1.0;
+    Vec3 direction;
+    Light_sample sample;
+    auto distance = infinity;
+
+    if (lights == nullptr || (background.sampled && random_double() < 0.5)) {
+        if (!background.environment->sample(direction, sample.radiance, sample.pdf)) { return {0, 0, 0}; }
+    } else {
+        auto normal = record.material_ptr->light_sampling() == Light_sampling::surface ? record.normal : Vec3(0, 0, 0);
+        const Light *light = nullptr;
+        double pmf = 0;
+        if (!lights->choose(record.point, normal, light, pmf) || !sample_light(*light, record.point, sample)) {
+            return {0, 0, 0};
+        }
+
+        auto to_light = sample.point - record.point;
+        distance = to_light.length() - 0.001;
+        direction = to_light / to_light.length();
+        sample.pdf *= pmf;
+    }
+
+    auto value = record.material_ptr->scattering_value(ray, record, direction);
+    if (value.near_zero()) { return {0, 0, 0}; }
+
+    ++rays_traced;
+    Hit_record blocker;
+    if (world.hit(Ray(record.point, direction, ray.time()), 0.001, distance, blocker)) { return {0, 0, 0}; }
+
+    return value * sample.radiance / (sample.pdf * choice);
+}
+
+// Move the differential's rays onto the plane tangent to the hit and take the footprint there from how far apart they
+// land. Rays running parallel to the plane end the chain.
+void transfer_differential(Ray_differential &differential, Hit_record &record) {
+    auto plane = dot(record.normal, record.point);
+    auto x_cosine = dot(record.normal, differential.x_direction);
+    auto y_cosine = dot(record.normal, differential.y_direction);
+    if (x_cosine == 0 || y_cosine == 0) {
+        differential.valid = false;
+        return;
+    }
+
+    differential.x_origin += (plane - dot(record.normal, differential.x_origin)) / x_cosine * differential.x_direction;
+    differential.y_origin += (plane - dot(record.normal, differential.y_origin)) / y_cosine * differential.y_direction;
+    record.footprint = std::max((differential.x_origin - record.point).length(),
+                                (differential.y_origin - record.point).length());
+}
+
+// With lights or a sampled environment, materials that can take direct light samples do so at each bounce (but the
+// last), and the path they scatter then leaves out the emission of sampled lights and environment, which the sample
+// already accounted for. A valid differential gives hits a footprint for texture filtering as long as the path stays
+// specular.
+Color ray_color(const Ray &ray, const Background &background, const Hittable &world, int depth,
+                const Light_bvh *lights = nullptr, bool lights_sampled = false, Ray_differential differential = {}) {
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0) {
+        return {0, 0, 0};
+    }
+
+    ++rays_traced;
+    RT_STAT_RAY(depth);
+
+    Hit_record record;
+
+    // If the ray hits nothing, return the background color.
+    if (!world.hit(ray, 0.001, infinity, record))
+        return lights_sampled && background.sampled ? Color(0, 0, 0) : background.value(ray.direction());
+    finalize_hit(ray, record);
+    if (differential.valid) { transfer_differential(differential, record); }
+
+    Ray scattered;
+    Color attenuation;
+    Color emitted = lights_sampled && record.material_ptr->sampled_light()
+                    ? Color(0, 0, 0) : record.material_ptr->emitted(record.u, record.v, record.point);
+
+    if (!record.material_ptr->scatter(ray, record, attenuation, scattered))
+        return emitted;
+
+    auto sample_lights = (lights != nullptr || background.sampled) && depth > 1 &&
+                         record.material_ptr->light_sampling() != Light_sampling::none;
+    if (sample_lights) { emitted += sample_direct_light(ray, record, world, lights, background); }
+
+    if (differential.valid) {
+        differential.valid = record.material_ptr->scatter_differential(ray, record, scattered, differential);
+    }
+
+    return emitted + attenuation * ray_color(scattered, background, world, depth - 1, lights, sample_lights,
+                                             differential);
+}
+
+struct Scene {
+    Camera camera;
+    Background background;
+    std::unique_ptr<Hittable> world;
+    std::unique_ptr<Light_bvh> lights;  // null when nothing is sampled directly
+    double bvh_build_seconds = 0.0;
+    std::uint64_t identity = 0;         // hash of what the scene was built from, see build_scene
+};
+
+// Gather the world's emitters into the scene's light BVH; the scene keeps none when there are no lights to sample.
+// An environment map is sampled alongside.
+void build_lights(Scene &scene) {
+    RT_TRACE_SCOPE("light_bvh_build");
+
+    Light_collector collector;
+    scene.world->collect_lights(collector, Vec3(0, 0, 0), true);
+    auto lights = collector.finish();
+    scene.lights = lights.empty() ? nullptr : std::make_unique<Light_bvh>(std::move(lights));
+    scene.background.sampled = scene.background.environment != nullptr;
+}
+
+// Rows of pixels in a band of an Accumulation_buffer, the unit of work handed to a render thread.
+const int default_tile_rows = 16;
+
+class Image {
+public:
+    double aspect_ratio = 0.0;
+    int width = 0;
+    int height = 0;
+    int sample_per_pixel = 0;
+    int max_depth = 0;
+    unsigned int seed = 0;
+    unsigned int thread_count = 0;      // 0 for one per hardware thread
+    int tile_rows = default_tile_rows;
+    bool cache_textures = true;         // see Texture_cache
+
+    Image() = default;
+
+    Image(double _aspect_ratio, int _width, int _sample_per_pixel, int _max_depth)
+            : aspect_ratio(_aspect_ratio), width(_width), height(static_cast<int>(_width / _aspect_ratio)),
+              sample_per_pixel(_sample_per_pixel), max_depth(_max_depth) {}
+
+
+    void set_width(int _width) {
+        width = _width;
+        height = static_cast<int>(width / aspect_ratio);
+    }
+
+    [[nodiscard]] unsigned int threads() const {
+        return thread_count > 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency());
+    }
+};
+
+// Sum of sample_count samples of pixel (i, j), counted from the bottom left corner.
+Color trace_samples(const Scene &scene, const Image &image, int j, int i, int sample_count) {
+    Color pixel_color(0, 0, 0);
+
+    for (int s = 0; s < sample_count; ++s) {
+        auto u = (i + random_double()) / (image.width - 1);
+        auto v = (j + random_double()) / (image.height - 1);
+
+        Ray_differential differential;
+        Ray ray = scene.camera.get_ray(u, v, 1.0 / (image.width - 1), 1.0 / (image.height - 1), differential);
+        pixel_color += ray_color(ray, scene.background, *scene.world, image.max_depth, scene.lights.get(), false,
+                                 differential);
+    }
+    return pixel_color;
+}
+
+Color trace(const Scene &scene, const Image &image, int j, int i) {
+    return trace_samples(scene, image, j, i, image.sample_per_pixel) / float(image.sample_per_pixel);
+}
+
+// Allocator for storage that starts on a cache line, see Accumulation_buffer.
+template<typename T>
+struct Cache_line_allocator {
+    static constexpr size_t cache_line = 64;
+
+    using value_type = T;
+
+    Cache_line_allocator() = default;
+
+    template<typename U>
+    Cache_line_allocator(const Cache_line_allocator<U> &) {}
+
+    T *allocate(size_t count) {
+        return static_cast<T *>(::operator new[](count * sizeof(T), std::align_val_t(cache_line)));
+    }
+
+    void deallocate(T *pointer, size_t) { ::operator delete[](pointer, std::align_val_t(cache_line)); }
+
+    friend bool operator==(const Cache_line_allocator &, const Cache_line_allocator &) { return true; }
+};
+
+// Per-pixel sample sums of an image rendered progressively, pixels in output order (top row first).
+// Rows are grouped into bands that each draw from their own generator, so a pass renders the same samples whatever
+// the thread count, and the generators plus the sums are all a checkpoint needs to continue a render exactly.
+// Generators are seeded from the image seed, the band and first_sample, the index of the buffer's first sample in
+// the whole render, so that buffers holding different sample ranges of one image are decorrelated. The band height
+// changes which samples are drawn, so renders only match when it does.
+// Each band's sums and counts start on a cache line of their own, so threads rendering neighbouring bands never write
+// to the same line; reach them through band_sums and row_sums rather than by pixel index. During a pass a band's flag
+// is set, after all of its pixels, by the thread that rendered it, and finished_bands counts the flags for progress
+// reports.
+class Accumulation_buffer {
+public:
+    int width = 0;
+    int height = 0;
+    int rows_per_band = default_tile_rows;
+    unsigned int first_sample = 0;
+    std::vector<float, Cache_line_allocator<float>> sums;                   // three per pixel, padded per band
+    std::vector<std::uint32_t, Cache_line_allocator<std::uint32_t>> sample_counts;
+    std::vector<std::mt19937> band_generators;
+
+    Accumulation_buffer() = default;
+
+    Accumulation_buffer(int _width, int _height, unsigned int seed, unsigned int _first_sample = 0,
+                        int _rows_per_band = default_tile_rows);
+
+    explicit Accumulation_buffer(const Image &image, unsigned int _first_sample = 0)
+            : Accumulation_buffer(image.width, image.height, image.seed, _first_sample, image.tile_rows) {}
+
+    [[nodiscard]] int band_count() const { return (height + rows_per_band - 1) / rows_per_band; }
+
+    [[nodiscard]] int band_rows(int band) const { return std::min(height - band * rows_per_band, rows_per_band); }
+
+    // Three sums per pixel of the band's rows, one after the other.
+    [[nodiscard]] float *band_sums(int band) { return sums.data() + size_t(band) * band_value_stride; }
+
+    [[nodiscard]] const float *band_sums(int band) const { return sums.data() + size_t(band) * band_value_stride; }
+
+    [[nodiscard]] std::uint32_t *band_counts(int band) {
+        return sample_counts.data() + size_t(band) * band_pixel_stride;
+    }
+
+    [[nodiscard]] const std::uint32_t *band_counts(int band) const {
+        return sample_counts.data() + size_t(band) * band_pixel_stride;
+    }
+
+    [[nodiscard]] float *row_sums(int row) {
+        return band_sums(row / rows_per_band) + 3 * size_t(row % rows_per_band) * width;
+    }
+
+    [[nodiscard]] const float *row_sums(int row) const {
+        return band_sums(row / rows_per_band) + 3 * size_t(row % rows_per_band) * width;
+    }
+
+    [[nodiscard]] std::uint32_t *row_counts(int row) {
+        return band_counts(row / rows_per_band) + size_t(row % rows_per_band) * width;
+    }
+
+    [[nodiscard]] const std::uint32_t *row_counts(int row) const {
+        return band_counts(row / rows_per_band) + size_t(row % rows_per_band) * width;
+    }
+
+    // Samples every pixel has received so far.
+    [[nodiscard]] std::uint32_t completed_samples() const;
+
+    // Clear the band flags for another pass.
+    void start_pass();
+
+    // Publish a band whose pixels are all written.
+    void finish_band(int band) {
+        band_done[band].store(true, std::memory_order_release);
+        finished_band_count->fetch_add(1, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool band_finished(int band) const { return band_done[band].load(std::memory_order_acquire); }
+
+    [[nodiscard]] int finished_bands() const {
+        return finished_band_count ? finished_band_count->load(std::memory_order_acquire) : 0;
+    }
+
+private:
+    size_t band_value_stride = 0;       // floats from one band's sums to the next
+    size_t band_pixel_stride = 0;       // counts from one band's to the next
+    std::unique_ptr<std::atomic<bool>[]> band_done;
+    std::unique_ptr<std::atomic<int>> finished_band_count;
+};
+
+Accumulation_buffer::Accumulation_buffer(int _width, int _height, unsigned int seed, unsigned int _first_sample,
+                                         int _rows_per_band)
+        : width(_width), height(_height), rows_per_band(std::max(1, _rows_per_band)), first_sample(_first_sample) {
+    auto round_to_line = [](size_t count, size_t size) {
+        auto per_line = Cache_line_allocator<float>::cache_line / size;
+        return (count + per_line - 1) / per_line * per_line;
+    };
+    band_value_stride = round_to_line(3 * size_t(width) * rows_per_band, sizeof(float));
+    band_pixel_stride = round_to_line(size_t(width) * rows_per_band, sizeof(std::uint32_t));
+    sums.assign(band_value_stride * band_count(), 0.0f);
+    sample_counts.assign(band_pixel_stride * band_count(), 0);
+
+    for (int band = 0; band < band_count(); ++band) {
+        std::seed_seq band_seed{seed, static_cast<unsigned int>(band), first_sample};
+        band_generators.emplace_back(band_seed);
+    }
+
+    band_done = std::make_unique<std::atomic<bool>[]>(static_cast<size_t>(std::max(0, band_count())));
+    finished_band_count = std::make_unique<std::atomic<int>>(0);
+}
+
+std::uint32_t Accumulation_buffer::completed_samples() const {
+    if (sample_counts.empty()) { return 0; }
+
+    auto samples = band_counts(0)[0];
+    for (int band = 0; band < band_count(); ++band) {
+        const auto *counts = band_counts(band);
+        samples = std::min(samples, *std::min_element(counts, counts + size_t(band_rows(band)) * width));
+    }
+    return samples;
+}
+
+void Accumulation_buffer::start_pass() {
+    for (int band = 0; band < band_count(); ++band) { band_done[band].store(false, std::memory_order_relaxed); }
+    finished_band_count->store(0, std::memory_order_relaxed);
+}
+
+// Turns the per-pixel averages of a buffer into output codes through post a row at a time, so writers stream rows
+// from a few small scratch arrays instead of converting the whole image first.
+class Row_encoder {
+public:
+    Row_encoder(const Accumulation_buffer &_buffer, const Post_process &_post)
+            : buffer(_buffer), post(_post), divisors(3 * size_t(_buffer.width)), values(3 * size_t(_buffer.width)),
+              row_codes(3 * size_t(_buffer.width)) {}
+
+    // Three codes per pixel of row, valid until the next call.
+    const std::uint16_t *codes(int row);
+
+private:
+    const Accumulation_buffer &buffer;
+    const Post_process &post;
+    std::vector<float> divisors;
+    std::vector<float> values;
+    std::vector<std::uint16_t> row_codes;
+};
+
+const std::uint16_t *Row_encoder::codes(int row) {
+    auto row_size = 3 * buffer.width;
+    const auto *counts = buffer.row_counts(row);
+    const auto *sums = buffer.row_sums(row);
+    auto *row_divisors = divisors.data();
+    auto *row_values = values.data();
+
+    for (int column = 0; column < buffer.width; ++column) {
+        auto divisor = counts[column] > 0 ? float(counts[column]) : 1.0f;
+        row_divisors[3 * column] = row_divisors[3 * column + 1] = row_divisors[3 * column + 2] = divisor;
+    }
+
+    // Sums over counts, or over 1 for pixels without samples, in a loop the compiler vectorizes.
+    for (int i = 0; i < row_size; ++i) { row_values[i] = sums[i] / row_divisors[i]; }
+
+    post.run(row_values, row_size, row, row_codes.data());
+    return row_codes.data();
+}
+
+// count codes as output samples: a byte each for 8 bits, big-endian byte pairs for 16.
+inline void pack_samples(const std::uint16_t *codes, int count, int bits, unsigned char *target) {
+    if (bits <= 8) {
+        for (int i = 0; i < count; ++i) { target[i] = static_cast<unsigned char>(codes[i]); }
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        target[2 * i] = static_cast<unsigned char>(codes[i] >> 8);
+        target[2 * i + 1] = static_cast<unsigned char>(codes[i]);
+    }
+}
+
+// Write the per-pixel averages as a text PPM image.
+void write_ppm(std::ostream &out, const Accumulation_buffer &buffer, const Post_process &post = {}) {
+    RT_TRACE_SCOPE("image_write");
+    out << "P3\n" << buffer.width << ' ' << buffer.height << '\n' << (1 << post.bits) - 1 << '\n';
+
+    // One line per pixel, formatted a row at a time.
+    Row_encoder encoder(buffer, post);
+    std::string line(size_t(buffer.width) * 3 * 6, ' ');
+    for (int row = 0; row < buffer.height; ++row) {
+        const auto *codes = encoder.codes(row);
+        char *end = line.data();
+        for (int i = 0; i < 3 * buffer.width; ++i) {
+            end = std::to_chars(end, line.data() + line.size(), codes[i]).ptr;
+            *end++ = i % 3 == 2 ? '\n' : ' ';
+        }
+        out.write(line.data(), end - line.data());
+    }
+}
+
+// Output samples of the image (see pack_samples), top row first.
+inline std::vector<unsigned char> frame_pixels(const Accumulation_buffer &buffer, const Post_process &post = {}) {
+    RT_TRACE_SCOPE("post_process");
+
+    auto row_bytes = 3 * size_t(buffer.width) * (post.bits <= 8 ? 1 : 2);
+    std::vector<unsigned char> pixels(row_bytes * buffer.height);
+    Row_encoder encoder(buffer, post);
+    for (int row = 0; row < buffer.height; ++row) {
+        pack_samples(encoder.codes(row), 3 * buffer.width, post.bits, pixels.data() + row * row_bytes);
+    }
+    return pixels;
+}
+
+inline std::string ppm_header(int width, int height, int bits) {
+    return "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + '\n' + std::to_string((1 << bits) - 1) +
+           '\n';
+}
+
+// Headers of a 24-bit BMP: little-endian, followed by BGR rows from the bottom up, each padded to four bytes.
+inline std::string bmp_header(int width, int height) {
+    auto row_size = (3 * width + 3) & ~3;
+    std::string header(54, '\0');
+
+    auto put = [&header](size_t offset, std::uint32_t value, int bytes) {
+        for (int b = 0; b < bytes; ++b) { header[offset + b] = static_cast<char>(value >> (8 * b)); }
+    };
+    header[0] = 'B';
+    header[1] = 'M';
+    put(2, static_cast<std::uint32_t>(54 + size_t(row_size) * height), 4);
+    put(10, 54, 4);             // pixel data offset
+    put(14, 40, 4);             // info header size
+    put(18, width, 4);
+    put(22, height, 4);
+    put(26, 1, 2);              // planes
+    put(28, 24, 2);             // bits per pixel
+    return header;
+}
+
+// A BMP row from 8-bit RGB samples, padding left untouched.
+inline void pack_bgr(const unsigned char *rgb, int width, char *target) {
+    for (int column = 0; column < width; ++column) {
+        target[3 * column] = static_cast<char>(rgb[3 * column + 2]);
+        target[3 * column + 1] = static_cast<char>(rgb[3 * column + 1]);
+        target[3 * column + 2] = static_cast<char>(rgb[3 * column]);
+    }
+}
+
+inline std::string encode_ppm(const std::vector<unsigned char> &pixels, int width, int height, int bits = 8) {
+    auto out = ppm_header(width, height, bits);
+    out.append(pixels.begin(), pixels.end());
+    return out;
+}
+
+// 24-bit BMP from 8-bit samples.
+inline std::string encode_bmp(const std::vector<unsigned char> &pixels, int width, int height) {
+    auto row_size = (3 * width + 3) & ~3;
+    auto out = bmp_header(width, height);
+    out.resize(54 + size_t(row_size) * height, '\0');
+    for (int row = 0; row < height; ++row) {
+        pack_bgr(pixels.data() + 3 * size_t(height - 1 - row) * width, width, out.data() + 54 + size_t(row) * row_size);
+    }
+    return out;
+}
+
+enum class Image_format { ppm_text, ppm_binary, bmp };
+
+inline bool parse_image_format(std::string_view name, Image_format &format) {
+    if (name == "ppm") {
+        format = Image_format::ppm_text;
+    } else if (name == "ppm-binary") {
+        format = Image_format::ppm_binary;
+    } else if (name == "bmp") {
+        format = Image_format::bmp;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Write the per-pixel averages in the given format; BMP only holds 8-bit samples. Binary formats stream a row at a
+// time from the buffer, so nothing image-sized is allocated.
+void write_image(std::ostream &out, const Accumulation_buffer &buffer, Image_format format,
+                 const Post_process &post = {}) {
+    if (format == Image_format::ppm_text) {
+        write_ppm(out, buffer, post);
+        return;
+    }
+
+    RT_TRACE_SCOPE("image_write");
+    Row_encoder encoder(buffer, post);
+    if (format == Image_format::ppm_binary) {
+        out << ppm_header(buffer.width, buffer.height, post.bits);
+        std::vector<unsigned char> row_bytes(3 * size_t(buffer.width) * (post.bits <= 8 ? 1 : 2));
+        for (int row = 0; row < buffer.height; ++row) {
+            pack_samples(encoder.codes(row), 3 * buffer.width, post.bits, row_bytes.data());
+            out.write(reinterpret_cast<const char *>(row_bytes.data()), static_cast<std::streamsize>(row_bytes.size()));
+        }
+        return;
+    }
+
+    out << bmp_header(buffer.width, buffer.height);
+    std::vector<unsigned char> rgb(3 * size_t(buffer.width));
+    std::string row_bytes((3 * buffer.width + 3) & ~3, '\0');
+    for (int row = buffer.height - 1; row >= 0; --row) {
+        pack_samples(encoder.codes(row), 3 * buffer.width, 8, rgb.data());
+        pack_bgr(rgb.data(), buffer.width, row_bytes.data());
+        out.write(row_bytes.data(), static_cast<std::streamsize>(row_bytes.size()));
+    }
+}
+
+// Write the image to path, or to standard output when path is empty.
+bool write_image(const std::string &path, const Accumulation_buffer &buffer, Image_format format,
+                 const Post_process &post = {}) {
+    if (path.empty()) {
+        write_image(std::cout, buffer, format, post);
+        return static_cast<bool>(std::cout.flush());
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    write_image(out, buffer, format, post);
+    if (!out.flush()) {
+        std::cerr << "ERROR: Could not write image '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+// Add up to sample_count samples to every pixel of one band short of image.sample_per_pixel, on the calling thread.
+void render_band(const Image &image, const Scene &scene, Accumulation_buffer &buffer, int band, int sample_count) {
+    RT_TRACE_SCOPE("band", band);
+    random_generator() = buffer.band_generators[band];
+    texture_cache().reset(image.cache_textures);
+
+    auto last_row = std::min(buffer.height, (band + 1) * buffer.rows_per_band);
+    for (int row = band * buffer.rows_per_band; row < last_row; ++row) {
+        auto *sums = buffer.row_sums(row);
+        auto *counts = buffer.row_counts(row);
+        for (int column = 0; column < buffer.width; ++column) {
+            auto first = static_cast<int>(counts[column]);
+            auto count = std::min(sample_count, image.sample_per_pixel - first);
+            if (count <= 0) { continue; }
+
+            auto color = trace_samples(scene, image, image.height - 1 - row, column, count);
+            sums[3 * column] += float(color.x());
+            sums[3 * column + 1] += float(color.y());
+            sums[3 * column + 2] += float(color.z());
+            counts[column] += count;
+        }
+    }
+
+    buffer.band_generators[band] = random_generator();
+}
+
+// How often render_pass reports progress while its workers run.
+const auto progress_interval = std::chrono::milliseconds(250);
+
+// Add up to sample_count samples to every pixel short of image.sample_per_pixel, calling progress() every
+// progress_interval while the workers run and once more at the end; buffer.finished_bands() tells how far the pass
+// is. Returns the rays traced.
+template<typename Progress>
+unsigned long long render_pass(const Image &image, const Scene &scene, Accumulation_buffer &buffer, int sample_count,
+                               Progress &&progress) {
+    RT_TRACE_SCOPE("render_pass");
+
+    std::atomic<int> next_band{0};
+    std::vector<std::future<unsigned long long>> workers;
+
+    buffer.start_pass();
+    for (unsigned int worker = 0; worker < image.threads(); ++worker) {
+        workers.push_back(std::async(std::launch::async, [&image, &scene, &buffer, &next_band, sample_count]() {
+            rays_traced = 0;
+
+            for (int band = next_band++; band < buffer.band_count(); band = next_band++) {
+                render_band(image, scene, buffer, band, sample_count);
+                buffer.finish_band(band);
+            }
+
+            return rays_traced;
+        }));
+    }
+
+    unsigned long long rays = 0;
+    for (auto &worker: workers) {
+        while (worker.wait_for(progress_interval) != std::future_status::ready) { progress(); }
+        rays += worker.get();
+    }
+    progress();
+    return rays;
+}
+
+unsigned long long render_pass(const Image &image, const Scene &scene, Accumulation_buffer &buffer, int sample_count) {
+    return render_pass(image, scene, buffer, sample_count, []() {});
+}
+
+#endif //RAY_TRACING_IN_CPP_RENDER_H
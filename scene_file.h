@@ -0,0 +1,711 @@
+#ifndef RAY_TRACING_IN_CPP_SCENE_FILE_H
+#define RAY_TRACING_IN_CPP_SCENE_FILE_H
+
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+#include "aa_rectangle.h"
+#include "box.h"
+#include "bvh.h"
+#include "Camera.h"
+#include "compiled_scene.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "Hittable_list.h"
+#include "Material.h"
+#include "Moving_sphere.h"
+#include "render.h"
+#include "Sphere.h"
+#include "Texture.h"
+#include "voxel_grid.h"
+
+// Text scene description, one statement per line; '#' starts a comment. Numbers are plain decimals, names start
+// with a letter or '_' and must be defined once before use, relative file paths are resolved against the scene file.
+// <color> is three numbers, <albedo> is either a <color> or a texture name, <point> and <vector> are three numbers.
+//
+//   image <width> <height> <samples_per_pixel> <max_depth>
+//   camera <look_from> <look_at> <view_up> <vertical_fov> <aperture> <focus_distance> [<open_time> <close_time>]
+//   background <color>
+//   environment <file> [<scale>]
+//   world bvh|list
+//
+//   texture <name> solid <color>
+//   texture <name> checker <albedo even> <albedo odd>
+//   texture <name> noise <scale>
+//   texture <name> image <file>
+//
+//   material <name> diffuse <albedo>
+//   material <name> metal <color> <fuzziness>
+//   material <name> dielectric <index_of_refraction>
+//   material <name> light <albedo>
+//   material <name> isotropic <albedo>
+//
+// Objects, each optionally followed by transforms applied left to right:
+// rotate_x|rotate_y|rotate_z <degrees>, translate <vector>.
+//
+//   sphere <center> <radius> <material>
+//   moving_sphere <center0> <center1> <time0> <time1> <radius> <material>
+//   xy_rect <x0> <x1> <y0> <y1> <z> <material>
+//   xz_rect <x0> <x1> <z0> <z1> <y> <material>
+//   yz_rect <y0> <y1> <z0> <z1> <x> <material>
+//   box <min> <max> <material>
+//   constant_medium <shape> <density> <albedo>
+//   heterogeneous_medium <shape> <density texture> <max_density> <albedo> [<grid_resolution>]
+//   voxel_volume <file> <albedo>
+//   instance <shape>
+//
+// Objects go into the world unless they are inside a group or prefixed by a shape definition:
+//
+//   shape <name> <object>      defines a shape, e.g. a medium boundary, without adding it
+//   group <name> ... end       collects the objects in between into a BVH shape
+inline bool is_compiled_primitive(std::string_view keyword) {
+    return keyword == "sphere" || keyword == "moving_sphere" || keyword == "xy_rect" || keyword == "xz_rect" ||
+           keyword == "yz_rect" || keyword == "box";
+}
+
+class Scene_parser {
+public:
+    // When set, top-level primitives without transforms go to the compiler instead of the world, and every other
+    // line is copied to its residual text.
+    Compiled_scene_builder *compiler = nullptr;
+
+    Scene_parser(std::string _path, Image &_image, Scene &_scene);
+
+    bool parse(std::string_view text);
+
+    // Add the primitives of a compiled scene, resolving its materials against the ones parsed so far.
+    bool attach(const shared_ptr<Compiled_scene> &compiled);
+
+    // Build the camera and the world once every statement is parsed.
+    bool finish();
+
+private:
+    struct Name_hash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    template<typename T>
+    using Name_table = std::unordered_map<std::string, shared_ptr<T>, Name_hash, std::equal_to<>>;
+
+    std::string path;
+    std::filesystem::path directory;
+    Image &image;
+    Scene &scene;
+
+    std::string_view line;
+    size_t position = 0;
+    int line_number = 0;
+    bool line_compiled = false;
+
+    std::string_view camera_arguments;
+    int camera_line = 0;
+
+    Name_table<Texture> textures;
+    Name_table<Material> materials;
+    Name_table<Hittable> shapes;
+
+    Hittable_list world;
+    std::vector<std::pair<std::string, Hittable_list>> groups;
+    bool build_bvh = true;
+    bool has_camera = false;
+
+    bool parse_statement(std::string_view keyword);
+
+    bool parse_camera();
+
+    bool parse_texture();
+
+    bool parse_material();
+
+    bool parse_object(std::string_view keyword, shared_ptr<Hittable> &object);
+
+    bool parse_primitive(std::string_view keyword, Compiled_primitive &primitive, shared_ptr<Material> &material,
+                         std::string_view &material_name);
+
+    bool parse_transforms(shared_ptr<Hittable> &object);
+
+    bool add_object(const shared_ptr<Hittable> &object);
+
+    bool next_token(std::string_view &token);
+
+    [[nodiscard]] bool at_end();
+
+    [[nodiscard]] bool next_is_number();
+
+    bool read_name(std::string_view &name);
+
+    bool read_number(double &value);
+
+    bool read_int(int &value);
+
+    bool read_vector(Vec3 &value);
+
+    bool read_albedo(shared_ptr<Texture> &texture);
+
+    bool read_material(shared_ptr<Material> &material, std::string_view &name);
+
+    bool read_shape(shared_ptr<Hittable> &shape);
+
+    template<typename T>
+    bool define(Name_table<T> &table, std::string_view name, const shared_ptr<T> &value);
+
+    [[nodiscard]] std::string resolve(std::string_view file) const;
+
+    bool error(const std::string &message) const;
+};
+
+Scene_parser::Scene_parser(std::string _path, Image &_image, Scene &_scene)
+        : path(std::move(_path)), directory(std::filesystem::path(path).parent_path()), image(_image), scene(_scene) {}
+
+bool Scene_parser::parse(std::string_view text) {
+    size_t line_start = 0;
+    while (line_start < text.size()) {
+        auto line_end = text.find('\n', line_start);
+        if (line_end == std::string_view::npos) { line_end = text.size(); }
+
+        auto raw_line = text.substr(line_start, line_end - line_start);
+        line = raw_line;
+        if (auto comment = line.find('#'); comment != std::string_view::npos) { line = line.substr(0, comment); }
+        position = 0;
+        ++line_number;
+        line_start = line_end + 1;
+        line_compiled = false;
+
+        if (std::string_view keyword; next_token(keyword)) {
+            // The camera needs the final aspect ratio, so it is built in finish() once the image can't change.
+            if (keyword == "camera") {
+                camera_line = line_number;
+                camera_arguments = line.substr(position);
+                has_camera = true;
+            } else if (!parse_statement(keyword)) {
+                return false;
+            }
+        }
+
+        // Compiled lines stay as blank lines so errors in the residual text keep their line numbers.
+        if (compiler != nullptr) {
+            if (!line_compiled) { compiler->residual += raw_line; }
+            compiler->residual += '\n';
+        }
+    }
+
+    if (!groups.empty()) {
+        return error("group '" + groups.back().first + "' is missing its 'end'");
+    }
+
+    return true;
+}
+
+bool Scene_parser::attach(const shared_ptr<Compiled_scene> &compiled) {
+    for (auto name: compiled->material_names()) {
+        auto found = materials.find(name);
+        if (found == materials.end()) {
+            return error("compiled scene uses unknown material '" + std::string(name) + "'");
+        }
+        compiled->materials.push_back(found->second);
+    }
+
+    if (compiled->primitive_count() > 0) { world.add(compiled); }
+    return true;
+}
+
+bool Scene_parser::finish() {
+    if (!has_camera) {
+        return error("no camera statement");
+    }
+    line = camera_arguments;
+    position = 0;
+    line_number = camera_line;
+    if (!parse_camera()) { return false; }
+
+    if (world.objects.empty()) {
+        return error("the scene has no objects");
+    }
+
+    RT_TRACE_SCOPE("scene_file_bvh");
+    auto bvh_start = std::chrono::steady_clock::now();
+    if (build_bvh) {
+        scene.world = std::make_unique<BVH_node>(world, 0, 1);
+    } else {
+        scene.world = std::make_unique<Hittable_list>(world);
+    }
+    scene.bvh_build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+
+    return true;
+}
+
+bool Scene_parser::parse_statement(std::string_view keyword) {
+    if (keyword == "image") {
+        int width;
+        int height;
+        int sample_per_pixel;
+        int max_depth;
+        if (!read_int(width) || !read_int(height) || !read_int(sample_per_pixel) || !read_int(max_depth)) {
+            return false;
+        }
+        if (width <= 0 || height <= 0) { return error("image size must be positive"); }
+        if (sample_per_pixel <= 0 || max_depth <= 0) { return error("samples per pixel and depth must be positive"); }
+
+        image.aspect_ratio = double(width) / height;
+        image.width = width;
+        image.height = height;
+        image.sample_per_pixel = sample_per_pixel;
+        image.max_depth = max_depth;
+    } else if (keyword == "background") {
+        if (!read_vector(scene.background.color)) { return false; }
+    } else if (keyword == "environment") {
+        std::string_view file;
+        double scale = 1;
+        if (!next_token(file)) { return error("expected an environment map file"); }
+        if (!at_end() && !read_number(scale)) { return false; }
+
+        auto environment = make_shared<Environment_map>();
+        if (!Environment_map::load(resolve(file).c_str(), scale, *environment)) {
+            return error("could not load environment map");
+        }
+        scene.background.environment = environment;
+    } else if (keyword == "world") {
+        std::string_view mode;
+        if (!read_name(mode)) { return false; }
+        if (mode != "bvh" && mode != "list") { return error("expected 'bvh' or 'list'"); }
+        build_bvh = mode == "bvh";
+    } else if (keyword == "texture") {
+        if (!parse_texture()) { return false; }
+    } else if (keyword == "material") {
+        if (!parse_material()) { return false; }
+    } else if (keyword == "shape") {
+        std::string_view name;
+        std::string_view object_keyword;
+        shared_ptr<Hittable> object;
+        if (!read_name(name)) { return false; }
+        if (!next_token(object_keyword)) { return error("expected an object after the shape name"); }
+        if (!parse_object(object_keyword, object) || !parse_transforms(object)) { return false; }
+
+        if (!define(shapes, name, object)) { return false; }
+    } else if (keyword == "group") {
+        std::string_view name;
+        if (!read_name(name)) { return false; }
+        groups.emplace_back(std::string(name), Hittable_list());
+    } else if (keyword == "end") {
+        if (groups.empty()) { return error("'end' without a group"); }
+
+        auto [name, objects] = std::move(groups.back());
+        groups.pop_back();
+        if (objects.objects.empty()) { return error("group '" + name + "' is empty"); }
+
+        if (!define(shapes, name, shared_ptr<Hittable>(make_shared<BVH_node>(objects, 0, 1)))) { return false; }
+    } else if (compiler != nullptr && groups.empty() && is_compiled_primitive(keyword)) {
+        Compiled_primitive primitive;
+        shared_ptr<Material> material;
+        std::string_view material_name;
+        if (!parse_primitive(keyword, primitive, material, material_name)) { return false; }
+
+        if (at_end()) {
+            compiler->add(primitive, material, material_name);
+            line_compiled = true;
+            return true;
+        }
+
+        auto object = make_primitive(primitive, material);
+        return parse_transforms(object) && add_object(object);
+    } else {
+        shared_ptr<Hittable> object;
+        if (!parse_object(keyword, object) || !parse_transforms(object)) { return false; }
+        return add_object(object);
+    }
+
+    if (!at_end()) { return error("unexpected trailing arguments"); }
+    return true;
+}
+
+bool Scene_parser::parse_camera() {
+    Point3 look_from;
+    Point3 look_at;
+    Vec3 view_up;
+    double vertical_field_of_view;
+    double aperture;
+    double focus_distance;
+    double open_time = 0;
+    double close_time = 0;
+
+    if (!read_vector(look_from) || !read_vector(look_at) || !read_vector(view_up) ||
+        !read_number(vertical_field_of_view) || !read_number(aperture) || !read_number(focus_distance)) {
+        return false;
+    }
+    if (!at_end() && (!read_number(open_time) || !read_number(close_time))) { return false; }
+    if (!at_end()) { return error("unexpected trailing arguments"); }
+
+    scene.camera = Camera(look_from, look_at, view_up, vertical_field_of_view, image.aspect_ratio, aperture,
+                          focus_distance, open_time, close_time);
+    return true;
+}
+
+bool Scene_parser::parse_texture() {
+    std::string_view name;
+    std::string_view kind;
+    if (!read_name(name) || !read_name(kind)) { return false; }
+
+    shared_ptr<Texture> texture;
+    if (kind == "solid") {
+        Color color;
+        if (!read_vector(color)) { return false; }
+        texture = make_shared<Solid_color>(color);
+    } else if (kind == "checker") {
+        shared_ptr<Texture> even;
+        shared_ptr<Texture> odd;
+        if (!read_albedo(even) || !read_albedo(odd)) { return false; }
+        texture = make_shared<Checker_texture>(even, odd);
+    } else if (kind == "noise") {
+        double scale;
+        if (!read_number(scale)) { return false; }
+        texture = make_shared<Noise_texture>(scale);
+    } else if (kind == "image") {
+        std::string_view file;
+        if (!next_token(file)) { return error("expected an image file"); }
+        texture = make_shared<Image_texture>(resolve(file).c_str());
+    } else {
+        return error("unknown texture type '" + std::string(kind) + "'");
+    }
+
+    return define(textures, name, texture);
+}
+
+bool Scene_parser::parse_material() {
+    std::string_view name;
+    std::string_view kind;
+    if (!read_name(name) || !read_name(kind)) { return false; }
+
+    shared_ptr<Material> material;
+    if (kind == "diffuse") {
+        shared_ptr<Texture> albedo;
+        if (!read_albedo(albedo)) { return false; }
+        material = make_shared<Diffuse>(albedo);
+    } else if (kind == "metal") {
+        Color albedo;
+        double fuzziness;
+        if (!read_vector(albedo) || !read_number(fuzziness)) { return false; }
+        material = make_shared<Metal>(albedo, fuzziness);
+    } else if (kind == "dielectric") {
+        double index_of_refraction;
+        if (!read_number(index_of_refraction)) { return false; }
+        material = make_shared<Dielectric>(index_of_refraction);
+    } else if (kind == "light") {
+        shared_ptr<Texture> emit;
+        if (!read_albedo(emit)) { return false; }
+        material = make_shared<Diffuse_light>(emit);
+    } else if (kind == "isotropic") {
+        shared_ptr<Texture> albedo;
+        if (!read_albedo(albedo)) { return false; }
+        material = make_shared<Isotropic>(albedo);
+    } else {
+        return error("unknown material type '" + std::string(kind) + "'");
+    }
+
+    return define(materials, name, material);
+}
+
+bool Scene_parser::parse_object(std::string_view keyword, shared_ptr<Hittable> &object) {
+    if (is_compiled_primitive(keyword)) {
+        Compiled_primitive primitive;
+        shared_ptr<Material> material;
+        std::string_view material_name;
+        if (!parse_primitive(keyword, primitive, material, material_name)) { return false; }
+        object = make_primitive(primitive, material);
+    } else if (keyword == "constant_medium") {
+        shared_ptr<Hittable> boundary;
+        double density;
+        shared_ptr<Texture> albedo;
+        if (!read_shape(boundary) || !read_number(density) || !read_albedo(albedo)) { return false; }
+        object = make_shared<Constant_medium>(boundary, density, albedo);
+    } else if (keyword == "heterogeneous_medium") {
+        shared_ptr<Hittable> boundary;
+        shared_ptr<Texture> density;
+        double max_density;
+        shared_ptr<Texture> albedo;
+        int grid_resolution = 8;
+        if (!read_shape(boundary) || !read_albedo(density) || !read_number(max_density) || !read_albedo(albedo)) {
+            return false;
+        }
+        if (next_is_number() && !read_int(grid_resolution)) { return false; }
+        object = make_shared<Heterogeneous_medium>(boundary, make_shared<Texture_density>(density, max_density),
+                                                   albedo, grid_resolution);
+    } else if (keyword == "voxel_volume") {
+        std::string_view file;
+        shared_ptr<Texture> albedo;
+        if (!next_token(file)) { return error("expected a voxel file"); }
+        auto grid = make_shared<Voxel_grid>();
+        if (!Voxel_grid::load(resolve(file).c_str(), *grid)) { return error("could not load voxel volume"); }
+        if (!read_albedo(albedo)) { return false; }
+        object = make_shared<Voxel_volume>(grid, albedo);
+    } else if (keyword == "instance") {
+        if (!read_shape(object)) { return false; }
+    } else {
+        return error("unknown statement '" + std::string(keyword) + "'");
+    }
+
+    return true;
+}
+
+bool Scene_parser::parse_primitive(std::string_view keyword, Compiled_primitive &primitive,
+                                   shared_ptr<Material> &material, std::string_view &material_name) {
+    int count;
+    if (keyword == "sphere") {
+        primitive.kind = Compiled_kind::Sphere;
+        count = 4;
+    } else if (keyword == "moving_sphere") {
+        primitive.kind = Compiled_kind::Moving_sphere;
+        count = 9;
+    } else if (keyword == "xy_rect") {
+        primitive.kind = Compiled_kind::xy_rectangle;
+        count = 5;
+    } else if (keyword == "xz_rect") {
+        primitive.kind = Compiled_kind::xz_rectangle;
+        count = 5;
+    } else if (keyword == "yz_rect") {
+        primitive.kind = Compiled_kind::yz_rectangle;
+        count = 5;
+    } else {
+        primitive.kind = Compiled_kind::Box;
+        count = 6;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (!read_number(primitive.data[i])) { return false; }
+    }
+    return read_material(material, material_name);
+}
+
+bool Scene_parser::parse_transforms(shared_ptr<Hittable> &object) {
+    std::string_view transform;
+    while (next_token(transform)) {
+        if (transform == "translate") {
+            Vec3 offset;
+            if (!read_vector(offset)) { return false; }
+            object = make_shared<Translate>(object, offset);
+        } else if (transform == "rotate_x" || transform == "rotate_y" || transform == "rotate_z") {
+            double angle;
+            if (!read_number(angle)) { return false; }
+            if (transform == "rotate_x") {
+                object = make_shared<Rotate_x>(object, angle);
+            } else if (transform == "rotate_y") {
+                object = make_shared<Rotate_y>(object, angle);
+            } else {
+                object = make_shared<Rotate_z>(object, angle);
+            }
+        } else {
+            return error("unexpected '" + std::string(transform) + "', expected a transform");
+        }
+    }
+
+    return true;
+}
+
+bool Scene_parser::add_object(const shared_ptr<Hittable> &object) {
+    AABB box;
+    if (!object->bounding_box(0, 1, box)) { return error("object has no bounding box"); }
+
+    if (groups.empty()) {
+        world.add(object);
+    } else {
+        groups.back().second.add(object);
+    }
+    return true;
+}
+
+bool Scene_parser::next_token(std::string_view &token) {
+    while (position < line.size() && (line[position] == ' ' || line[position] == '\t' || line[position] == '\r')) {
+        ++position;
+    }
+    if (position == line.size()) { return false; }
+
+    auto start = position;
+    while (position < line.size() && line[position] != ' ' && line[position] != '\t' && line[position] != '\r') {
+        ++position;
+    }
+    token = line.substr(start, position - start);
+    return true;
+}
+
+bool Scene_parser::at_end() {
+    auto saved = position;
+    std::string_view token;
+    auto end = !next_token(token);
+    position = saved;
+    return end;
+}
+
+bool Scene_parser::next_is_number() {
+    auto saved = position;
+    std::string_view token;
+    auto number = next_token(token) && (std::isdigit(static_cast<unsigned char>(token[0])) || token[0] == '-' ||
+                                        token[0] == '+' || token[0] == '.');
+    position = saved;
+    return number;
+}
+
+bool Scene_parser::read_name(std::string_view &name) {
+    if (!next_token(name)) { return error("expected a name"); }
+    if (!std::isalpha(static_cast<unsigned char>(name[0])) && name[0] != '_') {
+        return error("expected a name, got '" + std::string(name) + "'");
+    }
+    return true;
+}
+
+bool Scene_parser::read_number(double &value) {
+    std::string_view token;
+    if (!next_token(token)) { return error("expected a number"); }
+
+    // from_chars rejects a leading '+', which generated files sometimes carry.
+    if (token.size() > 1 && token[0] == '+') { token.remove_prefix(1); }
+    auto [end, status] = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (status != std::errc() || end != token.data() + token.size()) {
+        return error("expected a number, got '" + std::string(token) + "'");
+    }
+    return true;
+}
+
+bool Scene_parser::read_int(int &value) {
+    std::string_view token;
+    if (!next_token(token)) { return error("expected an integer"); }
+
+    auto [end, status] = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (status != std::errc() || end != token.data() + token.size()) {
+        return error("expected an integer, got '" + std::string(token) + "'");
+    }
+    return true;
+}
+
+bool Scene_parser::read_vector(Vec3 &value) {
+    return read_number(value[0]) && read_number(value[1]) && read_number(value[2]);
+}
+
+bool Scene_parser::read_albedo(shared_ptr<Texture> &texture) {
+    if (next_is_number()) {
+        Color color;
+        if (!read_vector(color)) { return false; }
+        texture = make_shared<Solid_color>(color);
+        return true;
+    }
+
+    std::string_view name;
+    if (!read_name(name)) { return false; }
+    auto found = textures.find(name);
+    if (found == textures.end()) { return error("unknown texture '" + std::string(name) + "'"); }
+    texture = found->second;
+    return true;
+}
+
+bool Scene_parser::read_material(shared_ptr<Material> &material, std::string_view &name) {
+    if (!read_name(name)) { return false; }
+    auto found = materials.find(name);
+    if (found == materials.end()) { return error("unknown material '" + std::string(name) + "'"); }
+    material = found->second;
+    return true;
+}
+
+bool Scene_parser::read_shape(shared_ptr<Hittable> &shape) {
+    std::string_view name;
+    if (!read_name(name)) { return false; }
+    auto found = shapes.find(name);
+    if (found == shapes.end()) { return error("unknown shape '" + std::string(name) + "'"); }
+    shape = found->second;
+    return true;
+}
+
+template<typename T>
+bool Scene_parser::define(Name_table<T> &table, std::string_view name, const shared_ptr<T> &value) {
+    if (!table.emplace(std::string(name), value).second) {
+        return error("'" + std::string(name) + "' is already defined");
+    }
+    return true;
+}
+
+std::string Scene_parser::resolve(std::string_view file) const {
+    std::filesystem::path file_path(file);
+    return file_path.is_absolute() ? file_path.string() : (directory / file_path).string();
+}
+
+bool Scene_parser::error(const std::string &message) const {
+    std::cerr << "ERROR: " << path << ':' << line_number << ": " << message << ".\n";
+    return false;
+}
+
+// Compile the flat part of a scene file into cache_path, for compiled_scene.h.
+bool compile_scene_file(const char *path, std::string_view text, const std::string &cache_path,
+                        std::uint64_t content_hash) {
+    RT_TRACE_SCOPE("scene_compile");
+
+    Image scratch_image;
+    Scene scratch_scene;
+    Compiled_scene_builder builder;
+
+    // Procedural textures draw random numbers when built; the real parse must see the same sequence.
+    auto generator_state = random_generator();
+
+    Scene_parser parser(path, scratch_image, scratch_scene);
+    parser.compiler = &builder;
+    auto compiled = parser.parse(text) && builder.write(cache_path, content_hash);
+
+    random_generator() = generator_state;
+    return compiled;
+}
+
+// Build a scene from a text scene file; image keeps its settings unless the file has an image statement.
+// With RAY_TRACING_SCENE_CACHE naming a directory, the file's primitives and their BVH are compiled there on the
+// first run, keyed by a hash of the file's contents, and memory-mapped on later runs.
+bool load_scene_file(const char *path, Image &image, Scene &scene) {
+    RT_TRACE_SCOPE("scene_file");
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open scene file '" << path << "'.\n";
+        return false;
+    }
+
+    std::string text;
+    file.seekg(0, std::ios::end);
+    text.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    file.read(text.data(), static_cast<std::streamsize>(text.size()));
+
+    Scene_parser parser(path, image, scene);
+    scene.identity = scene_content_hash(text);
+
+    const char *cache_directory = std::getenv("RAY_TRACING_SCENE_CACHE");
+    if (cache_directory == nullptr) {
+        return parser.parse(text) && parser.finish();
+    }
+
+    auto content_hash = scene.identity;
+    auto cache_path = compiled_scene_path(cache_directory, content_hash);
+
+    auto compiled = make_shared<Compiled_scene>();
+    if (!compiled->map(cache_path, content_hash)) {
+        if (!compile_scene_file(path, text, cache_path, content_hash)) { return false; }
+        if (!compiled->map(cache_path, content_hash)) {
+            std::cerr << "ERROR: Could not map compiled scene '" << cache_path << "'.\n";
+            return false;
+        }
+    }
+
+    return parser.parse(compiled->residual_text()) && parser.attach(compiled) && parser.finish();
+}
+
+#endif //RAY_TRACING_IN_CPP_SCENE_FILE_H
@@ -0,0 +1,415 @@
+#ifndef RAY_TRACING_IN_CPP_SCENES_H
+#define RAY_TRACING_IN_CPP_SCENES_H
+
+#include <chrono>
+#include <memory>
+
+#include "util.h"
+
+#include "aa_rectangle.h"
+#include "box.h"
+#include "bvh.h"
+#include "Camera.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "Hittable_list.h"
+#include "Material.h"
+#include "Moving_sphere.h"
+#include "render.h"
+#include "Sphere.h"
+#include "sphere_set.h"
+#include "Texture.h"
+#include "voxel_grid.h"
+
+shared_ptr<Material> select_material(double choose_mat) {
+    shared_ptr<Material> sphere_material;
+
+    if (choose_mat < 0.8) {
+        // diffuse
+        auto albedo = Color::random() * Color::random();
+        sphere_material = make_shared<Diffuse>(albedo);
+    } else if (choose_mat < 0.95) {
+        // metal
+        auto albedo = Color::random(0.5, 1);
+        auto fuzz = random_double(0, 0.5);
+        sphere_material = make_shared<Metal>(albedo, fuzz);
+    } else {
+        // glass
+        sphere_material = make_shared<Dielectric>(1.5);
+    }
+
+    return sphere_material;
+}
+
+void add_small_sphere(Sphere_set &spheres, double choose_mat, const Point3 &center,
+                      const shared_ptr<Material> &sphere_material) {
+    if (choose_mat < 0.8) {
+        auto center2 = center + Vec3(0, random_double(0, 0.5), 0);
+        spheres.add(center, center2, 0, 1, 0.2, sphere_material);
+    } else {
+        spheres.add(center, 0.2, sphere_material);
+    }
+}
+
+Hittable_list two_spheres() {
+    Hittable_list objects;
+
+    auto checker = make_shared<Checker_texture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+
+    objects.add(make_shared<Sphere>(Point3(0, -10, 0), 10, make_shared<Diffuse>(checker)));
+    objects.add(make_shared<Sphere>(Point3(0, 10, 0), 10, make_shared<Diffuse>(checker)));
+
+    return objects;
+}
+
+Hittable_list two_perlin_spheres() {
+    Hittable_list objects;
+
+    auto perlin_texture = make_shared<Noise_texture>(4);
+
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Diffuse>(perlin_texture)));
+    objects.add(make_shared<Sphere>(Point3(0, 2, 0), 2, make_shared<Diffuse>(perlin_texture)));
+
+    return objects;
+}
+
+Hittable_list random_scene() {
+    Hittable_list world;
+
+    auto ground_material = make_shared<Checker_texture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Diffuse>(ground_material)));
+
+    auto small_spheres = make_shared<Sphere_set>();
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            Point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<Material> sphere_material = select_material(choose_mat);
+
+                add_small_sphere(*small_spheres, choose_mat, center, sphere_material);
+            }
+        }
+    }
+    small_spheres->build(0, 1);
+    world.add(small_spheres);
+
+    auto material1 = make_shared<Dielectric>(1.5);
+    world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<Diffuse>(Color(0.4, 0.2, 0.1));
+    world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+Hittable_list earth() {
+    auto earth_texture = make_shared<Image_texture>("earth-map.jpg");
+    auto earth_surface = make_shared<Diffuse>(earth_texture);
+    auto globe = make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
+
+    return Hittable_list(globe);
+}
+
+Hittable_list simple_light() {
+    Hittable_list objects;
+
+    auto perlin_texture = make_shared<Noise_texture>(4);
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Diffuse>(perlin_texture)));
+    objects.add(make_shared<Sphere>(Point3(0, 2, 0), 2, make_shared<Diffuse>(perlin_texture)));
+
+    auto diffuse_light = make_shared<Diffuse_light>(Color(4, 4, 4));
+    objects.add(make_shared<xy_rectangle>(3, 5, 1, 3, -2, diffuse_light));
+    objects.add(make_shared<Sphere>(Point3(0, 8, 0), 2, diffuse_light));
+
+    return objects;
+}
+
+Hittable_list cornell_box() {
+    Hittable_list objects;
+
+    auto red = make_shared<Diffuse>(Color(.65, .05, .05));
+    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
+    auto green = make_shared<Diffuse>(Color(.12, .45, .15));
+    auto light = make_shared<Diffuse_light>(Color(15, 15, 15));
+
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rectangle>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xy_rectangle>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = make_shared<Rotate_y>(box1, 15);
+    box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
+    objects.add(box1);
+
+    shared_ptr<Hittable> box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = make_shared<Rotate_y>(box2, -18);
+    box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
+    objects.add(box2);
+
+    return objects;
+}
+
+Hittable_list cornell_smoke() {
+    Hittable_list objects;
+
+    auto red = make_shared<Diffuse>(Color(.65, .05, .05));
+    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
+    auto green = make_shared<Diffuse>(Color(.12, .45, .15));
+    auto light = make_shared<Diffuse_light>(Color(7, 7, 7));
+
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rectangle>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xy_rectangle>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = make_shared<Rotate_y>(box1, 15);
+    box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
+
+    shared_ptr<Hittable> box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = make_shared<Rotate_y>(box2, -18);
+    box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
+
+    objects.add(make_shared<Constant_medium>(box1, 0.01, Color(0, 0, 0)));
+    objects.add(make_shared<Constant_medium>(box2, 0.01, Color(1, 1, 1)));
+
+    return objects;
+}
+
+Hittable_list cornell_noise_smoke() {
+    Hittable_list objects;
+
+    auto red = make_shared<Diffuse>(Color(.65, .05, .05));
+    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
+    auto green = make_shared<Diffuse>(Color(.12, .45, .15));
+    auto light = make_shared<Diffuse_light>(Color(7, 7, 7));
+
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rectangle>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rectangle>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xz_rectangle>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xy_rectangle>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = make_shared<Rotate_y>(box1, 15);
+    box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
+
+    shared_ptr<Hittable> box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = make_shared<Rotate_y>(box2, -18);
+    box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
+
+    auto smoke = make_shared<Texture_density>(make_shared<Noise_texture>(0.02), 0.03);
+    objects.add(make_shared<Heterogeneous_medium>(box1, smoke, Color(0, 0, 0)));
+    objects.add(make_shared<Heterogeneous_medium>(box2, smoke, Color(1, 1, 1)));
+
+    return objects;
+}
+
+Hittable_list final_scene() {
+    auto ground = make_shared<Diffuse>(Color(0.48, 0.83, 0.53));
+
+    // Neighbouring boxes are clustered 2x2 so each BVH leaf tests four of them at once.
+    const int boxes_per_side = 20;
+    const int boxes_per_group_side = 2;
+    const int groups_per_side = boxes_per_side / boxes_per_group_side;
+    vector<shared_ptr<Box_group>> box_groups(groups_per_side * groups_per_side);
+    for (auto &group: box_groups) {
+        group = make_shared<Box_group>();
+    }
+
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1, 101);
+            auto z1 = z0 + w;
+
+            auto group_index = (i / boxes_per_group_side) * groups_per_side + j / boxes_per_group_side;
+            box_groups[group_index]->add(Point3(x0, y0, z0), Point3(x1, y1, z1), ground);
+        }
+    }
+
+    Hittable_list boxes1;
+    for (const auto &group: box_groups) {
+        boxes1.add(group);
+    }
+
+    Hittable_list objects;
+
+    objects.add(make_shared<BVH_node>(boxes1, 0, 1));
+
+    auto light = make_shared<Diffuse_light>(Color(7, 7, 7));
+    objects.add(make_shared<xz_rectangle>(123, 423, 147, 412, 554, light));
+
+    auto center1 = Point3(400, 400, 200);
+    auto center2 = center1 + Vec3(30, 0, 0);
+    auto moving_sphere_material = make_shared<Diffuse>(Color(0.7, 0.3, 0.1));
+    objects.add(make_shared<Moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+    objects.add(make_shared<Sphere>(Point3(260, 150, 45), 50, make_shared<Dielectric>(1.5)));
+    objects.add(make_shared<Sphere>(Point3(0, 150, 145), 50, make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
+
+    auto boundary = make_shared<Sphere>(Point3(360, 150, 145), 70, make_shared<Dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_shared<Constant_medium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+    boundary = make_shared<Sphere>(Point3(0, 0, 0), 5000, make_shared<Dielectric>(1.5));
+    objects.add(make_shared<Constant_medium>(boundary, .0001, Color(1, 1, 1)));
+
+    auto emat = make_shared<Diffuse>(make_shared<Image_texture>("earth-map.jpg"));
+    objects.add(make_shared<Sphere>(Point3(400, 200, 400), 100, emat));
+    auto pertext = make_shared<Noise_texture>(0.1);
+    objects.add(make_shared<Sphere>(Point3(220, 280, 300), 80, make_shared<Diffuse>(pertext)));
+
+    auto cluster = make_shared<Sphere_set>();
+    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        cluster->add(Point3::random(0, 165), 10, white);
+    }
+    cluster->build(0, 1);
+
+    objects.add(make_shared<Translate>(make_shared<Rotate_y>(cluster, 15), Vec3(-100, 270, 395)));
+
+    return objects;
+}
+
+// Synthetic stress scene: sphere_count small random spheres scattered in a cube above a ground plane.
+Hittable_list many_spheres(int sphere_count) {
+    Hittable_list objects;
+
+    auto ground = make_shared<Checker_texture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+    objects.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Diffuse>(ground)));
+
+    auto cube_side = 20.0;
+    auto radius = 0.5 * cube_side / std::cbrt(sphere_count);
+    auto spheres = make_shared<Sphere_set>();
+    for (int i = 0; i < sphere_count; ++i) {
+        auto center = Point3::random(-cube_side / 2, cube_side / 2) + Vec3(0, cube_side / 2, 0);
+        spheres->add(center, radius, select_material(random_double()));
+    }
+    spheres->build(0, 1);
+    objects.add(spheres);
+
+    return objects;
+}
+
+Scene choose_scene(int id, Image &image) {
+    Scene scene;
+    Hittable_list objects;
+    bool build_bvh = true;
+
+    image.aspect_ratio = 16. / 9.;
+    image.set_width(800);
+
+    switch (id) {
+        case 1:
+            objects = random_scene();
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.camera = Camera(Point3(13, 2, 3), Point3(0, 0, 0), Vec3(0, 1, 0), 20, 16. / 9., 0.1, 10., 0, 1);
+            break;
+
+        case 2:
+            objects = two_spheres();
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.camera = Camera(Point3(13, 2, 3), Point3(0, 0, 0), Vec3(0, 1, 0), 20, 16. / 9., 0., 10., 0, 1);
+            break;
+
+        case 3:
+            objects = two_perlin_spheres();
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.camera = Camera(Point3(13, 2, 3), Point3(0, 0, 0), Vec3(0, 1, 0), 20, 16. / 9., 0., 10., 0, 1);
+            break;
+
+        case 4:
+            objects = earth();
+            scene.background = Color(0.70, 0.80, 1.00);
+            scene.camera = Camera(Point3(13, 2, 3), Point3(0, 0, 0), Vec3(0, 1, 0), 20, 16. / 9., 0., 10., 0, 1);
+
+            break;
+
+        case 5:
+            objects = simple_light();
+            scene.background = Color(0.0, 0.0, 0.0);
+            scene.camera = Camera(Point3(26, 3, 6), Point3(0, 2, 0), Vec3(0, 1, 0), 20, 16. / 9., 0., 10., 0, 1);
+            break;
+
+        case 6:
+            objects = cornell_box();
+
+            image.aspect_ratio = 1.;
+            image.set_width(600);
+            image.sample_per_pixel = 200;
+
+            scene.background = Color(0, 0, 0);
+            scene.camera = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40, image.aspect_ratio, 0,
+                                  10, 0, 1);
+            break;
+
+        case 7:
+            objects = cornell_smoke();
+
+            image.aspect_ratio = 1.;
+            image.set_width(600);
+            image.sample_per_pixel = 200;
+
+            scene.background = Color(0, 0, 0);
+            scene.camera = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40, image.aspect_ratio, 0,
+                                  10, 0, 1);
+            break;
+
+        case 9:
+            objects = cornell_noise_smoke();
+
+            image.aspect_ratio = 1.;
+            image.set_width(600);
+            image.sample_per_pixel = 200;
+
+            scene.background = Color(0, 0, 0);
+            scene.camera = Camera(Point3(278, 278, -800), Point3(278, 278, 0), Vec3(0, 1, 0), 40, image.aspect_ratio, 0,
+                                  10, 0, 1);
+            break;
+
+        default:
+            // case 8:
+            objects = final_scene();
+            build_bvh = false;
+            image.aspect_ratio = 1.;
+            image.set_width(800);
+            image.sample_per_pixel = 10;
+
+            scene.background = Color(0, 0, 0);
+            scene.camera = Camera(Point3(478, 278, -600),
+                                  Point3(278, 278, 0),
+                                  Vec3(0, 1, 0),
+                                  40,
+                                  image.aspect_ratio,
+                                  0,
+                                  10, 0, 1);
+    }
+
+    auto bvh_start = std::chrono::steady_clock::now();
+    if (build_bvh) {
+        scene.world = std::make_unique<BVH_node>(objects, 0, 1);
+    } else {
+        scene.world = std::make_unique<Hittable_list>(objects);
+    }
+    scene.bvh_build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count();
+
+    return scene;
+}
+
+#endif //RAY_TRACING_IN_CPP_SCENES_H
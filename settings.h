@@ -0,0 +1,369 @@
+#ifndef RAY_TRACING_IN_CPP_SETTINGS_H
+#define RAY_TRACING_IN_CPP_SETTINGS_H
+
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "util.h"
+
+#include "animation.h"
+#include "render.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+const char *const render_usage =
+        "Usage: ray_tracing_in_cpp [options] [scene file]\n"
+        "\n"
+        "Scene and image:\n"
+        "  --scene ID                    built-in scene (see choose_scene) when no scene file is given; default 8\n"
+        "  --width W, --height H         image size; one alone keeps the scene's aspect ratio\n"
+        "  --spp N                       samples per pixel\n"
+        "  --depth N                     maximum bounces per path\n"
+        "  --seed N                      seed for the scene and the samples\n"
+        "  --environment FILE            environment map (HDR or LDR equirectangular image) replacing the background\n"
+        "  --threads N                   render threads; default one per hardware thread\n"
+        "  --tile-rows N                 rows per band handed to a thread (default 16)\n"
+        "  --light-sampling on|off       sample lights directly through a light BVH; default on\n"
+        "  --texture-cache on|off        share texture values between the samples of a pixel; default on\n"
+        "  --output FILE                 image file, or printf pattern of frame files with --frames; default stdout\n"
+        "\n"
+        "Render modes (exclusive):\n"
+        "  --checkpoint FILE [--resume] [--checkpoint-interval SECONDS] [--pass-samples N]\n"
+        "  --sample-range FIRST COUNT --accumulation FILE\n"
+        "  --coordinator PORT\n"
+        "  --worker HOST:PORT\n"
+        "  --frames FIRST LAST [--frame-count N] [--turntable DEGREES] [--rebuild-threshold R]\n"
+        "  --preview PORT [--pass-samples N]\n";
+
+// Options of Output_settings other than --output, shared with ray_tracing_merge.
+const char *const output_usage =
+        "Output:\n"
+        "  --format ppm|ppm-binary|bmp   image format; default from the output extension, else text PPM\n"
+        "  --exposure STOPS              scale the image by 2^STOPS before tonemapping; default 0\n"
+        "  --tonemap clamp|reinhard|aces tonemap operator; default clamp\n"
+        "  --transfer gamma2|srgb        display encoding; default gamma2\n"
+        "  --bits 8|16                   bits per sample (16 needs a PPM format); default 8\n"
+        "  --dither on|off               ordered dithering before quantization; default off\n";
+
+// Where and how the image is written.
+struct Output_settings {
+    std::string path;                   // empty for stdout
+    Image_format format = Image_format::ppm_text;
+    bool format_given = false;          // else the format follows the path's extension
+    Post_process post;
+};
+
+// Everything the driver needs to know about a run, from the command line. Image values left at 0 keep what the
+// scene asks for.
+struct Render_settings {
+    std::string scene_path;             // empty for the built-in scene
+    int scene_id = 8;                   // see choose_scene
+    std::string environment_path;       // empty for the scene's background
+
+    int width = 0;
+    int height = 0;
+    int sample_per_pixel = 0;
+    int max_depth = 0;
+    unsigned int seed = 0;
+    unsigned int thread_count = 0;      // see Image
+    int tile_rows = default_tile_rows;
+    bool light_sampling = true;         // see build_lights
+    bool texture_cache = true;          // see Texture_cache
+
+    Output_settings output;
+
+    std::string checkpoint_path;
+    bool resume = false;
+    double checkpoint_interval = 60;
+    int pass_samples = 4;
+
+    unsigned int first_sample = 0;      // with sample_count, see Accumulation_buffer
+    int sample_count = 0;
+    std::string accumulation_path;
+
+    int coordinator_port = 0;
+    std::string coordinator_address;
+    int preview_port = 0;
+
+    bool animate = false;
+    Sequence sequence;
+};
+
+// Parse text as a whole number within [minimum, maximum].
+template<typename T>
+bool parse_setting(std::string_view name, std::string_view text, T &value, T minimum, T maximum) {
+    T parsed{};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), parsed);
+    if (error != std::errc() || end != text.data() + text.size() || parsed < minimum || parsed > maximum) {
+        std::cerr << "Invalid value '" << text << "' for " << name << '\n';
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parse text as a finite number.
+inline bool parse_setting(std::string_view name, std::string_view text, double &value) {
+    try {
+        size_t end = 0;
+        auto parsed = std::stod(std::string(text), &end);
+        if (end == text.size() && std::isfinite(parsed)) {
+            value = parsed;
+            return true;
+        }
+    } catch (const std::exception &) {}
+
+    std::cerr << "Invalid value '" << text << "' for " << name << '\n';
+    return false;
+}
+
+// Apply argument, --output or one of output_usage, with value; false when it is none of them. ok tells whether the
+// value was valid, after printing why not.
+bool parse_output_option(std::string_view argument, std::string_view value, Output_settings &output, bool &ok) {
+    ok = true;
+    if (argument == "--output") {
+        output.path = value;
+    } else if (argument == "--format") {
+        ok = parse_image_format(value, output.format);
+        if (!ok) { std::cerr << "Unknown format " << value << " (expected ppm, ppm-binary or bmp)\n"; }
+        output.format_given = true;
+    } else if (argument == "--exposure") {
+        ok = parse_setting(argument, value, output.post.exposure);
+    } else if (argument == "--tonemap") {
+        ok = parse_tonemap(value, output.post.tonemap);
+        if (!ok) { std::cerr << "Unknown tonemap " << value << " (expected clamp, reinhard or aces)\n"; }
+    } else if (argument == "--transfer") {
+        ok = parse_transfer(value, output.post.transfer);
+        if (!ok) { std::cerr << "Unknown transfer " << value << " (expected gamma2 or srgb)\n"; }
+    } else if (argument == "--bits") {
+        ok = value == "8" || value == "16";
+        if (!ok) { std::cerr << "Invalid value '" << value << "' for " << argument << " (expected 8 or 16)\n"; }
+        output.post.bits = value == "16" ? 16 : 8;
+    } else if (argument == "--dither") {
+        ok = value == "on" || value == "off";
+        if (!ok) { std::cerr << "Invalid value '" << value << "' for " << argument << " (expected on or off)\n"; }
+        output.post.dither = value == "on";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Settle the format once all options are in; false when it can't hold the samples.
+bool finish_output_settings(Output_settings &output) {
+    if (!output.format_given && output.path.ends_with(".bmp")) {
+        output.format = Image_format::bmp;
+    }
+    if (output.post.bits > 8 && output.format == Image_format::bmp) {
+        std::cerr << "--bits 16 needs a PPM format\n";
+        return false;
+    }
+    return true;
+}
+
+// Fill settings from the command line; false after printing why it can't be used. --help prints the usage and
+// also returns false.
+bool parse_render_settings(int argc, char **argv, Render_settings &settings) {
+    const int max_int = std::numeric_limits<int>::max();
+    const unsigned int max_unsigned = std::numeric_limits<unsigned int>::max();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        auto two_values = argument == "--sample-range" || argument == "--frames";
+        bool ok = true;
+
+        if (argument == "--help") {
+            std::cerr << render_usage << '\n' << output_usage;
+            return false;
+        } else if (argument == "--resume") {
+            settings.resume = true;
+            continue;
+        } else if (argument.starts_with("--") && i + (two_values ? 2 : 1) >= argc) {
+            std::cerr << "Missing value for " << argument << '\n';
+            return false;
+        } else if (argument == "--scene") {
+            ok = parse_setting(argument, argv[++i], settings.scene_id, 1, 9);
+        } else if (argument == "--width") {
+            ok = parse_setting(argument, argv[++i], settings.width, 1, max_int);
+        } else if (argument == "--height") {
+            ok = parse_setting(argument, argv[++i], settings.height, 1, max_int);
+        } else if (argument == "--spp") {
+            ok = parse_setting(argument, argv[++i], settings.sample_per_pixel, 1, max_int);
+        } else if (argument == "--depth") {
+            ok = parse_setting(argument, argv[++i], settings.max_depth, 1, max_int);
+        } else if (argument == "--seed") {
+            ok = parse_setting(argument, argv[++i], settings.seed, 0u, max_unsigned);
+        } else if (argument == "--threads") {
+            ok = parse_setting(argument, argv[++i], settings.thread_count, 1u, 1024u);
+        } else if (argument == "--tile-rows") {
+            ok = parse_setting(argument, argv[++i], settings.tile_rows, 1, max_int);
+        } else if (argument == "--light-sampling") {
+            std::string_view value = argv[++i];
+            ok = value == "on" || value == "off";
+            if (!ok) { std::cerr << "Invalid value '" << value << "' for " << argument << " (expected on or off)\n"; }
+            settings.light_sampling = value == "on";
+        } else if (argument == "--texture-cache") {
+            std::string_view value = argv[++i];
+            ok = value == "on" || value == "off";
+            if (!ok) { std::cerr << "Invalid value '" << value << "' for " << argument << " (expected on or off)\n"; }
+            settings.texture_cache = value == "on";
+        } else if (argument == "--environment") {
+            settings.environment_path = argv[++i];
+        } else if (argument.starts_with("--") && parse_output_option(argument, argv[i + 1], settings.output, ok)) {
+            ++i;
+        } else if (argument == "--checkpoint") {
+            settings.checkpoint_path = argv[++i];
+        } else if (argument == "--checkpoint-interval") {
+            ok = parse_setting(argument, argv[++i], settings.checkpoint_interval);
+        } else if (argument == "--pass-samples") {
+            ok = parse_setting(argument, argv[++i], settings.pass_samples, 1, max_int);
+        } else if (argument == "--sample-range") {
+            ok = parse_setting(argument, argv[++i], settings.first_sample, 0u, max_unsigned) &&
+                 parse_setting(argument, argv[++i], settings.sample_count, 1, max_int);
+        } else if (argument == "--accumulation") {
+            settings.accumulation_path = argv[++i];
+        } else if (argument == "--coordinator") {
+            ok = parse_setting(argument, argv[++i], settings.coordinator_port, 1, 65535);
+        } else if (argument == "--worker") {
+            settings.coordinator_address = argv[++i];
+        } else if (argument == "--preview") {
+            ok = parse_setting(argument, argv[++i], settings.preview_port, 1, 65535);
+        } else if (argument == "--frames") {
+            ok = parse_setting(argument, argv[++i], settings.sequence.first_frame, 0, max_int) &&
+                 parse_setting(argument, argv[++i], settings.sequence.last_frame, 0, max_int);
+            settings.animate = true;
+        } else if (argument == "--frame-count") {
+            ok = parse_setting(argument, argv[++i], settings.sequence.frame_count, 1, max_int);
+        } else if (argument == "--turntable") {
+            ok = parse_setting(argument, argv[++i], settings.sequence.turntable_degrees);
+        } else if (argument == "--rebuild-threshold") {
+            ok = parse_setting(argument, argv[++i], settings.sequence.rebuild_threshold);
+        } else if (argument.starts_with("--")) {
+            std::cerr << "Unknown option " << argument << '\n';
+            return false;
+        } else {
+            settings.scene_path = argument;
+        }
+
+        if (!ok) { return false; }
+    }
+
+    if (!finish_output_settings(settings.output)) { return false; }
+
+    auto distributed = settings.coordinator_port != 0 || !settings.coordinator_address.empty();
+
+    if (settings.resume && settings.checkpoint_path.empty()) {
+        std::cerr << "--resume needs --checkpoint\n";
+        return false;
+    }
+    if ((settings.coordinator_port != 0) + !settings.coordinator_address.empty() +
+        !settings.checkpoint_path.empty() > 1) {
+        std::cerr << "--coordinator, --worker and --checkpoint are exclusive\n";
+        return false;
+    }
+    if ((settings.sample_count > 0) != !settings.accumulation_path.empty()) {
+        std::cerr << "--sample-range and --accumulation go together\n";
+        return false;
+    }
+    if (settings.sample_count > 0 && distributed) {
+        std::cerr << "--sample-range can't be combined with --coordinator or --worker\n";
+        return false;
+    }
+
+    if (settings.animate) {
+        const auto &sequence = settings.sequence;
+        if (sequence.first_frame > sequence.last_frame || sequence.last_frame >= sequence.frame_count) {
+            std::cerr << "--frames needs 0 <= FIRST <= LAST < frame count (" << sequence.frame_count << ")\n";
+            return false;
+        }
+        if (distributed || !settings.checkpoint_path.empty() || settings.sample_count > 0) {
+            std::cerr << "--frames can't be combined with --coordinator, --worker, --checkpoint or --sample-range\n";
+            return false;
+        }
+        if (!settings.output.path.empty()) { settings.sequence.output_pattern = settings.output.path; }
+        if (!valid_frame_pattern(settings.sequence.output_pattern)) {
+            std::cerr << "--output with --frames needs a pattern with one frame number (%d or %0Nd) and no other % "
+                      << "but %%\n";
+            return false;
+        }
+        settings.sequence.format = settings.output.format;
+        settings.sequence.post = settings.output.post;
+    }
+
+    if (settings.preview_port != 0 && (distributed || !settings.checkpoint_path.empty() ||
+                                       settings.sample_count > 0 || settings.animate)) {
+        std::cerr << "--preview can't be combined with other render modes\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Build the scene the settings name and size the image for it: the scene's own image settings, then the overrides.
+bool build_scene(const Render_settings &settings, Image &image, Scene &scene) {
+    RT_TRACE_SCOPE("scene_build");
+
+    image.seed = settings.seed;
+    seed_random(image.seed);
+    if (!settings.scene_path.empty()) {
+        if (!load_scene_file(settings.scene_path.c_str(), image, scene)) { return false; }
+    } else {
+        scene = choose_scene(settings.scene_id, image);
+    }
+
+    if (!settings.environment_path.empty()) {
+        auto environment = std::make_shared<Environment_map>();
+        if (!Environment_map::load(settings.environment_path.c_str(), 1.0, *environment)) { return false; }
+        scene.background.environment = environment;
+    }
+
+    if (settings.width > 0 && settings.height > 0) {
+        // Both given: the image takes their aspect ratio and the camera follows.
+        image.width = settings.width;
+        image.height = settings.height;
+        image.aspect_ratio = double(settings.width) / settings.height;
+        scene.camera = scene.camera.reshaped(image.aspect_ratio);
+    } else if (settings.width > 0) {
+        image.set_width(settings.width);
+    } else if (settings.height > 0) {
+        image.height = settings.height;
+        image.width = std::max(1, static_cast<int>(settings.height * image.aspect_ratio));
+    }
+
+    if (settings.sample_per_pixel > 0) { image.sample_per_pixel = settings.sample_per_pixel; }
+    if (settings.max_depth > 0) { image.max_depth = settings.max_depth; }
+    if (settings.sample_count > 0) { image.sample_per_pixel = settings.sample_count; }
+    image.thread_count = settings.thread_count;
+    image.tile_rows = settings.tile_rows;
+    image.cache_textures = settings.texture_cache;
+
+    if (settings.light_sampling) { build_lights(scene); }
+
+    // What a distributed render's coordinator and workers must agree on beyond the image settings: the scene file's
+    // contents (not those of files it refers to) or the built-in scene, the environment map, the options that change
+    // the samples and the final camera.
+    if (settings.scene_path.empty()) { scene.identity = hash_bytes(&settings.scene_id, sizeof(settings.scene_id)); }
+    if (!settings.environment_path.empty()) {
+        std::ifstream file(settings.environment_path, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        scene.identity = hash_bytes(contents.data(), contents.size(), scene.identity);
+    }
+    const bool options[] = {settings.light_sampling, settings.texture_cache};
+    scene.identity = hash_bytes(options, sizeof(options), scene.identity);
+    const auto &camera = scene.camera;
+    const double camera_values[] = {camera.origin.x(), camera.origin.y(), camera.origin.z(), camera.target.x(),
+                                    camera.target.y(), camera.target.z(), camera.up.x(), camera.up.y(), camera.up.z(),
+                                    camera.field_of_view, camera.aspect, camera.lens_radius, camera.focus,
+                                    camera.shutter_open_time, camera.shutter_close_time};
+    scene.identity = hash_bytes(camera_values, sizeof(camera_values), scene.identity);
+
+    return true;
+}
+
+#endif //RAY_TRACING_IN_CPP_SETTINGS_H
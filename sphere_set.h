@@ -0,0 +1,406 @@
+#ifndef RAY_TRACING_IN_CPP_SPHERE_SET_H
+#define RAY_TRACING_IN_CPP_SPHERE_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "util.h"
+
+#include "Hittable.h"
+#include "light.h"
+#include "Sphere.h"
+
+// Many spheres as one primitive: centers, velocities, radii and material indices stored as structure-of-arrays under
+// a BVH of the set's own, whose leaves hold up to lane_count spheres that are tested together, four per AVX
+// instruction when the build enables AVX (see RAY_TRACING_NATIVE). A sphere costs 60 bytes and no heap object,
+// reference count, BVH node or virtual call of its own, which keeps particle scenes of millions of spheres cheap.
+class Sphere_set : public Hittable {
+public:
+    static const int lane_count = 4;
+
+    Sphere_set() = default;
+
+    // Add a sphere moving linearly from center0 at time0 to center1 at time1.
+    void add(const Point3 &center0, const Point3 &center1, double time0, double time1, double radius,
+             const shared_ptr<Material> &material);
+
+    void add(const Point3 &center, double radius, const shared_ptr<Material> &material) {
+        add(center, center, 0, 1, radius, material);
+    }
+
+    // Build the set's BVH over the spheres' bounds for [time0, time1]; needed once all spheres are added.
+    void build(double time0, double time1);
+
+    [[nodiscard]] size_t size() const { return sphere_count; }
+
+    bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
+
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override;
+
+    bool bounding_box(double time0, double time1, AABB &output_box) const override;
+
+    bool motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const override;
+
+    void refit(double time0, double time1) override;
+
+    // Static emissive spheres are sampled like a Sphere; moving ones are left to scattering.
+    void collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const override;
+
+private:
+    // Depth first, as Compiled_bvh_node: an interior node's first child follows it, the second is at offset.
+    // Nodes whose spheres move also keep their bounds at both ends of the interval and test rays against the box
+    // blended to the ray's time, as BVH_node does.
+    struct Node {
+        AABB box;                   // over the whole interval
+        AABB box0;                  // at box_time0 and at box_time1
+        AABB box1;
+        bool moving = false;
+        std::uint32_t offset = 0;   // first sphere of a leaf, always a multiple of lane_count
+        std::uint32_t count = 0;    // spheres in a leaf, 0 for interior nodes
+        std::uint32_t axis = 0;
+    };
+
+    // Sphere i is at center + time * velocity. After build the arrays are in BVH order and padded to a whole number
+    // of lanes with spheres at infinity, which no ray can hit.
+    std::vector<double> center_x, center_y, center_z;
+    std::vector<double> velocity_x, velocity_y, velocity_z;
+    std::vector<double> radii;
+    std::vector<std::uint32_t> material_indices;
+    std::vector<shared_ptr<Material>> materials;
+    std::unordered_map<const Material *, std::uint32_t> material_lookup;
+    size_t sphere_count = 0;
+
+    std::vector<Node> nodes;
+    double box_time0 = 0;       // interval the node boxes bound
+    double box_time1 = 0;
+    double inverse_duration = 0;
+
+    [[nodiscard]] Point3 center(size_t i, double time) const {
+        return {center_x[i] + time * velocity_x[i], center_y[i] + time * velocity_y[i],
+                center_z[i] + time * velocity_z[i]};
+    }
+
+    [[nodiscard]] AABB sphere_box(size_t i, double time) const {
+        Vec3 extent(radii[i], radii[i], radii[i]);
+        return {center(i, time) - extent, center(i, time) + extent};
+    }
+
+    [[nodiscard]] AABB sphere_box(size_t i, double time0, double time1) const {
+        return surrounding_box(sphere_box(i, time0), sphere_box(i, time1));
+    }
+
+    void build_node(std::vector<std::uint32_t> &order, const std::vector<AABB> &boxes, std::uint32_t start,
+                    std::uint32_t end);
+
+    // Lane of the closest sphere in the leaf starting at base with a hit in [t_min, t_max], or -1.
+    int closest_lane(const Ray &ray, size_t base, double t_min, double t_max, double &t_closest) const;
+};
+
+void Sphere_set::add(const Point3 &center0, const Point3 &center1, double time0, double time1, double radius,
+                     const shared_ptr<Material> &material) {
+    auto found = material_lookup.find(material.get());
+    if (found == material_lookup.end()) {
+        found = material_lookup.emplace(material.get(), static_cast<std::uint32_t>(materials.size())).first;
+        materials.push_back(material);
+    }
+
+    // Spheres added after a build go after its padding, which build drops again.
+    for (auto *values: {&center_x, &center_y, &center_z, &velocity_x, &velocity_y, &velocity_z, &radii}) {
+        values->resize(sphere_count);
+    }
+    material_indices.resize(sphere_count);
+
+    auto velocity = time1 > time0 ? (center1 - center0) / (time1 - time0) : Vec3(0, 0, 0);
+    auto start = center0 - time0 * velocity;
+    center_x.push_back(start.x());
+    center_y.push_back(start.y());
+    center_z.push_back(start.z());
+    velocity_x.push_back(velocity.x());
+    velocity_y.push_back(velocity.y());
+    velocity_z.push_back(velocity.z());
+    radii.push_back(radius);
+    material_indices.push_back(found->second);
+    ++sphere_count;
+}
+
+void Sphere_set::build(double time0, double time1) {
+    RT_TRACE_SCOPE("sphere_set_build");
+
+    nodes.clear();
+    for (auto *values: {&center_x, &center_y, &center_z, &velocity_x, &velocity_y, &velocity_z, &radii}) {
+        values->resize(sphere_count);
+    }
+    material_indices.resize(sphere_count);
+    if (sphere_count == 0) { return; }
+
+    std::vector<AABB> boxes(sphere_count);
+    std::vector<std::uint32_t> order(sphere_count);
+    for (size_t i = 0; i < sphere_count; ++i) {
+        boxes[i] = sphere_box(i, time0, time1);
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+    build_node(order, boxes, 0, static_cast<std::uint32_t>(sphere_count));
+
+    auto permute = [&order](auto &values) {
+        std::remove_reference_t<decltype(values)> ordered;
+        ordered.reserve(order.size() + lane_count);
+        for (auto index: order) { ordered.push_back(values[index]); }
+        values = std::move(ordered);
+    };
+    for (auto *values: {&center_x, &center_y, &center_z, &velocity_x, &velocity_y, &velocity_z, &radii}) {
+        permute(*values);
+    }
+    permute(material_indices);
+
+    auto padded = (sphere_count + lane_count - 1) / lane_count * lane_count;
+    for (auto *values: {&center_x, &center_y, &center_z}) { values->resize(padded, infinity); }
+    for (auto *values: {&velocity_x, &velocity_y, &velocity_z, &radii}) { values->resize(padded, 0.0); }
+    material_indices.resize(padded, 0);
+
+    refit(time0, time1);
+}
+
+void Sphere_set::build_node(std::vector<std::uint32_t> &order, const std::vector<AABB> &boxes, std::uint32_t start,
+                            std::uint32_t end) {
+    auto node_index = nodes.size();
+    nodes.emplace_back();
+
+    if (end - start <= lane_count) {
+        nodes[node_index].offset = start;
+        nodes[node_index].count = end - start;
+        return;
+    }
+
+    Point3 centroid_min(infinity, infinity, infinity);
+    Point3 centroid_max(-infinity, -infinity, -infinity);
+    for (auto i = start; i < end; ++i) {
+        auto centroid = 0.5 * (boxes[order[i]].min() + boxes[order[i]].max());
+        for (int a = 0; a < 3; ++a) {
+            centroid_min[a] = fmin(centroid_min[a], centroid[a]);
+            centroid_max[a] = fmax(centroid_max[a], centroid[a]);
+        }
+    }
+
+    // Median split on the longest axis of the centroids, rounded so that every leaf starts on a lane boundary.
+    auto extent = centroid_max - centroid_min;
+    int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    auto half = (end - start + 1) / 2;
+    auto mid = start + (half + lane_count - 1) / lane_count * lane_count;
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                     [&boxes, axis](std::uint32_t a, std::uint32_t b) {
+                         return boxes[a].min()[axis] + boxes[a].max()[axis] <
+                                boxes[b].min()[axis] + boxes[b].max()[axis];
+                     });
+
+    build_node(order, boxes, start, mid);
+    nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+    nodes[node_index].axis = axis;
+    build_node(order, boxes, mid, end);
+}
+
+void Sphere_set::refit(double time0, double time1) {
+    box_time0 = time0;
+    box_time1 = time1;
+    inverse_duration = time1 > time0 ? 1 / (time1 - time0) : 0;
+
+    // Children come after their parent, so a backwards sweep sees them first.
+    for (auto node = nodes.rbegin(); node != nodes.rend(); ++node) {
+        if (node->count > 0) {
+            node->box0 = sphere_box(node->offset, time0);
+            node->box1 = sphere_box(node->offset, time1);
+            for (auto i = node->offset + 1; i < node->offset + node->count; ++i) {
+                node->box0 = surrounding_box(node->box0, sphere_box(i, time0));
+                node->box1 = surrounding_box(node->box1, sphere_box(i, time1));
+            }
+        } else {
+            auto index = static_cast<size_t>(nodes.rend() - node) - 1;
+            node->box0 = surrounding_box(nodes[index + 1].box0, nodes[node->offset].box0);
+            node->box1 = surrounding_box(nodes[index + 1].box1, nodes[node->offset].box1);
+        }
+        node->box = surrounding_box(node->box0, node->box1);
+        node->moving = !(node->box0 == node->box1) && time1 > time0;
+    }
+}
+
+void Sphere_set::collect_lights(Light_collector &collector, const Vec3 &offset, bool sampleable) const {
+    for (size_t i = 0; i < sphere_count; ++i) {
+        const auto &material = materials[material_indices[i]];
+        if (velocity_x[i] != 0 || velocity_y[i] != 0 || velocity_z[i] != 0) {
+            collector.exclude(material);
+        } else {
+            collector.add_sphere(center(i, 0) + offset, radii[i], material, sampleable);
+        }
+    }
+}
+
+bool Sphere_set::bounding_box(double time0, double time1, AABB &output_box) const {
+    if (sphere_count == 0) { return false; }
+
+    if (time0 == box_time0 && time1 == box_time1 && !nodes.empty()) {
+        output_box = nodes[0].box;
+        return true;
+    }
+
+    output_box = sphere_box(0, time0, time1);
+    for (size_t i = 1; i < sphere_count; ++i) {
+        output_box = surrounding_box(output_box, sphere_box(i, time0, time1));
+    }
+    return true;
+}
+
+bool Sphere_set::motion_bounds(double time0, double time1, AABB &box0, AABB &box1) const {
+    if (sphere_count == 0) { return false; }
+
+    if (time0 == box_time0 && time1 == box_time1 && !nodes.empty()) {
+        box0 = nodes[0].box0;
+        box1 = nodes[0].box1;
+        return true;
+    }
+
+    box0 = sphere_box(0, time0);
+    box1 = sphere_box(0, time1);
+    for (size_t i = 1; i < sphere_count; ++i) {
+        box0 = surrounding_box(box0, sphere_box(i, time0));
+        box1 = surrounding_box(box1, sphere_box(i, time1));
+    }
+    return true;
+}
+
+int Sphere_set::closest_lane(const Ray &ray, size_t base, double t_min, double t_max, double &t_closest) const {
+    const auto &origin = ray._origin;
+    const auto &direction = ray._direction;
+    const auto a = direction.length_squared();
+    double t_hit[lane_count];
+
+#if defined(__AVX__)
+    const auto time = _mm256_set1_pd(ray._time);
+    auto offset = [&](const std::vector<double> &centers, const std::vector<double> &velocities, int axis) {
+        auto lane_center = _mm256_add_pd(_mm256_loadu_pd(&centers[base]),
+                                         _mm256_mul_pd(time, _mm256_loadu_pd(&velocities[base])));
+        return _mm256_sub_pd(_mm256_set1_pd(origin[axis]), lane_center);
+    };
+    auto oc_x = offset(center_x, velocity_x, 0);
+    auto oc_y = offset(center_y, velocity_y, 1);
+    auto oc_z = offset(center_z, velocity_z, 2);
+    auto radius = _mm256_loadu_pd(&radii[base]);
+
+    // Same operations in the same order as Sphere::hit, so that a set renders like separate spheres.
+    auto half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc_x, _mm256_set1_pd(direction[0])),
+                                              _mm256_mul_pd(oc_y, _mm256_set1_pd(direction[1]))),
+                                _mm256_mul_pd(oc_z, _mm256_set1_pd(direction[2])));
+    auto c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc_x, oc_x), _mm256_mul_pd(oc_y, oc_y)),
+                                         _mm256_mul_pd(oc_z, oc_z)),
+                           _mm256_mul_pd(radius, radius));
+    auto a_lanes = _mm256_set1_pd(a);
+    auto discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a_lanes, c));
+    auto valid = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+
+    auto sqrt_discriminant = _mm256_sqrt_pd(discriminant);
+    auto negative_half_b = _mm256_xor_pd(half_b, _mm256_set1_pd(-0.0));
+    auto near_root = _mm256_div_pd(_mm256_sub_pd(negative_half_b, sqrt_discriminant), a_lanes);
+    auto far_root = _mm256_div_pd(_mm256_add_pd(negative_half_b, sqrt_discriminant), a_lanes);
+
+    auto lower = _mm256_set1_pd(t_min);
+    auto upper = _mm256_set1_pd(t_max);
+    auto near_in = _mm256_and_pd(_mm256_cmp_pd(near_root, lower, _CMP_GE_OQ),
+                                 _mm256_cmp_pd(near_root, upper, _CMP_LE_OQ));
+    auto far_in = _mm256_and_pd(_mm256_cmp_pd(far_root, lower, _CMP_GE_OQ),
+                                _mm256_cmp_pd(far_root, upper, _CMP_LE_OQ));
+    auto root = _mm256_blendv_pd(far_root, near_root, near_in);
+    auto hit = _mm256_and_pd(valid, _mm256_or_pd(near_in, far_in));
+    _mm256_storeu_pd(t_hit, _mm256_blendv_pd(_mm256_set1_pd(infinity), root, hit));
+#else
+    for (int lane = 0; lane < lane_count; ++lane) {
+        const auto i = base + lane;
+        Vec3 origin_center = origin - center(i, ray._time);
+
+        auto half_b = dot(origin_center, direction);
+        auto c = origin_center.length_squared() - radii[i] * radii[i];
+        auto discriminant = half_b * half_b - a * c;
+
+        t_hit[lane] = infinity;
+        if (!(discriminant >= 0)) { continue; }
+        auto sqrt_discriminant = sqrt(discriminant);
+
+        auto root = (-half_b - sqrt_discriminant) / a;
+        if (root < t_min || t_max < root) {
+            root = (-half_b + sqrt_discriminant) / a;
+            if (root < t_min || t_max < root) { continue; }
+        }
+        t_hit[lane] = root;
+    }
+#endif
+
+    int closest = -1;
+    for (int lane = 0; lane < lane_count; ++lane) {
+        if (t_hit[lane] < infinity && t_hit[lane] <= t_max) {
+            t_max = t_hit[lane];
+            closest = lane;
+        }
+    }
+
+    t_closest = t_max;
+    return closest;
+}
+
+bool Sphere_set::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Sphere_set);
+    if (nodes.empty()) { return false; }
+
+    std::uint32_t stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    while (stack_size > 0) {
+        auto node_index = stack[--stack_size];
+        const auto &node = nodes[node_index];
+        RT_STAT_BVH_NODE();
+
+        if (node.moving) {
+            auto blend = std::clamp((ray._time - box_time0) * inverse_duration, 0.0, 1.0);
+            if (!hit_blended(node.box0, node.box1, blend, ray, t_min, closest_so_far)) { continue; }
+        } else if (!node.box.hit(ray, t_min, closest_so_far)) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            double t;
+            auto lane = closest_lane(ray, node.offset, t_min, closest_so_far, t);
+            if (lane >= 0) {
+                rec.set_hit(t, this, static_cast<int>(node.offset) + lane);
+                closest_so_far = t;
+                hit_anything = true;
+            }
+            continue;
+        }
+
+        // Visit the child on the ray's side of the split first; it is popped last.
+        auto first = node_index + 1;
+        auto second = node.offset;
+        if (ray.sign(static_cast<int>(node.axis))) { std::swap(first, second); }
+        stack[stack_size++] = second;
+        stack[stack_size++] = first;
+    }
+
+    return hit_anything;
+}
+
+void Sphere_set::finalize_hit(const Ray &ray, Hit_record &rec) const {
+    auto i = static_cast<size_t>(rec.index);
+    rec.point = ray.at(rec.t);
+    Vec3 outward_normal = (rec.point - center(i, ray.time())) / radii[i];
+    rec.set_face_normal(ray, outward_normal);
+    Sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.material_ptr = materials[material_indices[i]].get();
+}
+
+#endif //RAY_TRACING_IN_CPP_SPHERE_SET_H
@@ -0,0 +1,159 @@
+#ifndef RAY_TRACING_IN_CPP_STATS_H
+#define RAY_TRACING_IN_CPP_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Hot-path counters, enabled at compile time with RAY_TRACING_STATS (CMake option of the same name).
+// Each thread increments its own Render_stats without synchronisation; merge_render_stats() sums them once the
+// render jobs are joined. When the option is off every RT_STAT_* macro expands to nothing.
+
+enum class Stat_primitive {
+    Sphere, Moving_sphere, xy_rectangle, xz_rectangle, yz_rectangle, Box, Box_group, Sphere_set,
+    Constant_medium, Heterogeneous_medium, Voxel_volume, Translate, Rotate, Count
+};
+
+enum class Stat_material {
+    Diffuse, Metal, Dielectric, Diffuse_light, Isotropic, Count
+};
+
+enum class Stat_texture {
+    Solid_color, Checker_texture, Noise_texture, Image_texture, Count
+};
+
+struct Render_stats {
+    static const int depth_slots = 64;
+
+    // Indexed by the remaining depth passed to ray_color, so primary rays land in the highest used slot.
+    std::array<unsigned long long, depth_slots> rays_by_depth{};
+    unsigned long long bvh_nodes_visited = 0;
+    unsigned long long box_tests = 0;
+    std::array<unsigned long long, static_cast<size_t>(Stat_primitive::Count)> primitive_tests{};
+    std::array<unsigned long long, static_cast<size_t>(Stat_material::Count)> scatter_calls{};
+    std::array<unsigned long long, static_cast<size_t>(Stat_texture::Count)> texture_lookups{};
+
+    Render_stats &operator+=(const Render_stats &other) {
+        for (size_t i = 0; i < rays_by_depth.size(); ++i) { rays_by_depth[i] += other.rays_by_depth[i]; }
+        bvh_nodes_visited += other.bvh_nodes_visited;
+        box_tests += other.box_tests;
+        for (size_t i = 0; i < primitive_tests.size(); ++i) { primitive_tests[i] += other.primitive_tests[i]; }
+        for (size_t i = 0; i < scatter_calls.size(); ++i) { scatter_calls[i] += other.scatter_calls[i]; }
+        for (size_t i = 0; i < texture_lookups.size(); ++i) { texture_lookups[i] += other.texture_lookups[i]; }
+        return *this;
+    }
+};
+
+#if defined(RAY_TRACING_STATS)
+const bool render_stats_enabled = true;
+#else
+const bool render_stats_enabled = false;
+#endif
+
+// Owns every thread's counters so they outlive the threads that filled them.
+class Render_stats_registry {
+public:
+    Render_stats *add() {
+        std::lock_guard lock(mutex);
+        all.push_back(std::make_unique<Render_stats>());
+        return all.back().get();
+    }
+
+    Render_stats merge() {
+        std::lock_guard lock(mutex);
+        Render_stats merged;
+        for (const auto &stats: all) { merged += *stats; }
+        return merged;
+    }
+
+    void reset() {
+        std::lock_guard lock(mutex);
+        for (const auto &stats: all) { *stats = Render_stats(); }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Render_stats>> all;
+};
+
+inline Render_stats_registry &render_stats_registry() {
+    static Render_stats_registry registry;
+    return registry;
+}
+
+inline Render_stats &thread_render_stats() {
+    thread_local Render_stats *stats = render_stats_registry().add();
+    return *stats;
+}
+
+// Only call these while no render job is running.
+inline Render_stats merge_render_stats() { return render_stats_registry().merge(); }
+
+inline void reset_render_stats() { render_stats_registry().reset(); }
+
+#if defined(RAY_TRACING_STATS)
+#define RT_STAT_RAY(depth) (++thread_render_stats().rays_by_depth[std::min<int>(depth, Render_stats::depth_slots - 1)])
+#define RT_STAT_BVH_NODE() (++thread_render_stats().bvh_nodes_visited)
+#define RT_STAT_BOX_TEST() (++thread_render_stats().box_tests)
+#define RT_STAT_PRIMITIVE(kind) (++thread_render_stats().primitive_tests[static_cast<size_t>(Stat_primitive::kind)])
+#define RT_STAT_SCATTER(kind) (++thread_render_stats().scatter_calls[static_cast<size_t>(Stat_material::kind)])
+#define RT_STAT_TEXTURE(kind) (++thread_render_stats().texture_lookups[static_cast<size_t>(Stat_texture::kind)])
+#else
+#define RT_STAT_RAY(depth) ((void) 0)
+#define RT_STAT_BVH_NODE() ((void) 0)
+#define RT_STAT_BOX_TEST() ((void) 0)
+#define RT_STAT_PRIMITIVE(kind) ((void) 0)
+#define RT_STAT_SCATTER(kind) ((void) 0)
+#define RT_STAT_TEXTURE(kind) ((void) 0)
+#endif
+
+inline void print_render_stats(std::ostream &out, const Render_stats &stats) {
+    static const char *primitive_names[] = {"Sphere", "Moving_sphere", "xy_rectangle", "xz_rectangle",
+                                            "yz_rectangle", "Box", "Box_group", "Sphere_set", "Constant_medium",
+                                            "Heterogeneous_medium", "Voxel_volume", "Translate", "Rotate"};
+    static const char *material_names[] = {"Diffuse", "Metal", "Dielectric", "Diffuse_light", "Isotropic"};
+    static const char *texture_names[] = {"Solid_color", "Checker_texture", "Noise_texture", "Image_texture"};
+
+    unsigned long long rays = 0;
+    int primary_slot = -1;
+    for (int slot = 0; slot < Render_stats::depth_slots; ++slot) {
+        rays += stats.rays_by_depth[slot];
+        if (stats.rays_by_depth[slot] > 0) { primary_slot = slot; }
+    }
+
+    out << "Render statistics\n";
+    out << "  rays traced: " << rays << '\n';
+    for (int slot = primary_slot; slot >= 0; --slot) {
+        if (stats.rays_by_depth[slot] == 0) { continue; }
+        out << "    bounce " << primary_slot - slot << ": " << stats.rays_by_depth[slot] << '\n';
+    }
+
+    auto per_ray = [rays](unsigned long long count) { return rays > 0 ? double(count) / double(rays) : 0.0; };
+
+    out << "  BVH nodes visited: " << stats.bvh_nodes_visited << " (" << per_ray(stats.bvh_nodes_visited)
+        << " per ray)\n";
+    out << "  box tests: " << stats.box_tests << " (" << per_ray(stats.box_tests) << " per ray)\n";
+
+    out << "  primitive tests:\n";
+    for (size_t i = 0; i < stats.primitive_tests.size(); ++i) {
+        if (stats.primitive_tests[i] == 0) { continue; }
+        out << "    " << primitive_names[i] << ": " << stats.primitive_tests[i] << '\n';
+    }
+
+    out << "  scatter calls:\n";
+    for (size_t i = 0; i < stats.scatter_calls.size(); ++i) {
+        if (stats.scatter_calls[i] == 0) { continue; }
+        out << "    " << material_names[i] << ": " << stats.scatter_calls[i] << '\n';
+    }
+
+    out << "  texture lookups:\n";
+    for (size_t i = 0; i < stats.texture_lookups.size(); ++i) {
+        if (stats.texture_lookups[i] == 0) { continue; }
+        out << "    " << texture_names[i] << ": " << stats.texture_lookups[i] << '\n';
+    }
+}
+
+#endif //RAY_TRACING_IN_CPP_STATS_H
@@ -0,0 +1,155 @@
+#ifndef RAY_TRACING_IN_CPP_TRACE_H
+#define RAY_TRACING_IN_CPP_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline of render phases in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Spans are recorded per thread into fixed-size ring buffers: the owning thread is the only writer, so recording
+// takes no lock. start_tracing() arms the recorder and writes the JSON file when the process exits.
+
+struct Trace_event {
+    const char *name = nullptr;   // must outlive the trace, i.e. a string literal
+    long long begin_us = 0;
+    long long end_us = 0;
+    long long argument = -1;      // optional index shown in the viewer, -1 for none
+};
+
+class Trace_buffer {
+public:
+    static const size_t capacity = 1 << 14;   // the oldest spans are overwritten past this
+
+    int thread_id;
+
+    explicit Trace_buffer(int _thread_id) : thread_id(_thread_id) {}
+
+    void push(const Trace_event &event) {
+        auto index = head.load(std::memory_order_relaxed);
+        events[index % capacity] = event;
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    [[nodiscard]] std::vector<Trace_event> snapshot() const {
+        auto end = head.load(std::memory_order_acquire);
+        auto begin = end > capacity ? end - capacity : 0;
+
+        std::vector<Trace_event> result;
+        for (auto i = begin; i < end; ++i) { result.push_back(events[i % capacity]); }
+        return result;
+    }
+
+private:
+    std::atomic<size_t> head{0};
+    std::array<Trace_event, capacity> events;
+};
+
+class Trace_recorder {
+public:
+    std::atomic<bool> enabled{false};
+    std::string path;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    Trace_buffer *add_thread() {
+        std::lock_guard lock(mutex);
+        buffers.push_back(std::make_unique<Trace_buffer>(static_cast<int>(buffers.size())));
+        return buffers.back().get();
+    }
+
+    [[nodiscard]] long long now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    bool write() {
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << "ERROR: Could not write trace file '" << path << "'.\n";
+            return false;
+        }
+
+        std::lock_guard lock(mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+        bool first = true;
+        for (const auto &buffer: buffers) {
+            out << (first ? "" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )"
+                << buffer->thread_id << R"(, "args": {"name": ")"
+                << (buffer->thread_id == 0 ? std::string("main") : "worker " + std::to_string(buffer->thread_id))
+                << "\"}}";
+            first = false;
+
+            for (const auto &event: buffer->snapshot()) {
+                out << ",\n" << R"({"name": ")" << event.name << R"(", "ph": "X", "pid": 1, "tid": )"
+                    << buffer->thread_id << ", \"ts\": " << event.begin_us
+                    << ", \"dur\": " << event.end_us - event.begin_us;
+                if (event.argument >= 0) { out << ", \"args\": {\"index\": " << event.argument << '}'; }
+                out << '}';
+            }
+        }
+
+        out << "\n]}\n";
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Trace_buffer>> buffers;
+};
+
+inline Trace_recorder &trace_recorder() {
+    static Trace_recorder recorder;
+    return recorder;
+}
+
+inline Trace_buffer &thread_trace_buffer() {
+    thread_local Trace_buffer *buffer = trace_recorder().add_thread();
+    return *buffer;
+}
+
+// Start recording spans; the trace is written to path at exit.
+inline void start_tracing(const std::string &path) {
+    auto &recorder = trace_recorder();
+    recorder.path = path;
+    thread_trace_buffer();   // the calling thread gets id 0
+    recorder.enabled = true;
+    std::atexit([] { trace_recorder().write(); });
+}
+
+// Records the enclosing scope as one span when tracing is enabled.
+class Trace_scope {
+public:
+    explicit Trace_scope(const char *name, long long argument = -1) {
+        if (!trace_recorder().enabled.load(std::memory_order_relaxed)) { return; }
+
+        event.name = name;
+        event.argument = argument;
+        event.begin_us = trace_recorder().now_us();
+    }
+
+    ~Trace_scope() {
+        if (event.name == nullptr) { return; }
+
+        event.end_us = trace_recorder().now_us();
+        thread_trace_buffer().push(event);
+    }
+
+    Trace_scope(const Trace_scope &) = delete;
+
+    Trace_scope &operator=(const Trace_scope &) = delete;
+
+private:
+    Trace_event event;
+};
+
+#define RT_TRACE_CONCAT_INNER(a, b) a##b
+#define RT_TRACE_CONCAT(a, b) RT_TRACE_CONCAT_INNER(a, b)
+#define RT_TRACE_SCOPE(...) Trace_scope RT_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif //RAY_TRACING_IN_CPP_TRACE_H
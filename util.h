@@ -22,11 +22,21 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+inline std::mt19937 &random_generator() {
+    // One generator per thread: render jobs must not share (and race on) a single engine.
+    thread_local std::mt19937 generator(std::random_device{}());
+    return generator;
+}
+
+inline void seed_random(unsigned int seed) {
+    // Makes the calling thread's random sequence reproducible.
+    random_generator().seed(seed);
+}
+
 inline double random_double() {
     // Returns a random real in [0, 1).
-    static std::uniform_real_distribution distribution(0.0, 1.0);
-    static std::mt19937 generator(std::random_device{}());
-    return distribution(generator);
+    thread_local std::uniform_real_distribution distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 inline double random_double(double lower_bound, double upper_bound) {
@@ -47,6 +57,8 @@ inline double clamp(double x, double min, double max) {
 
 // Common Headers
 #include "Ray.h"
+#include "stats.h"
+#include "trace.h"
 #include "Vec3.h"
 
 #endif //RAY_TRACING_IN_CPP_UTIL_H
@@ -0,0 +1,375 @@
+#ifndef RAY_TRACING_IN_CPP_VOXEL_GRID_H
+#define RAY_TRACING_IN_CPP_VOXEL_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#include "box.h"
+#include "heterogeneous_medium.h"
+#include "Hittable.h"
+#include "Material.h"
+
+// Raw density volume file: this header followed by nx * ny * nz little-endian float32 densities, x varying fastest.
+struct Voxel_file_header {
+    char magic[4];          // "RTVX"
+    std::uint32_t version;  // 1
+    std::uint32_t nx;
+    std::uint32_t ny;
+    std::uint32_t nz;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+// Sparse voxel density grid.
+// Voxels live in 8^3 bricks allocated only where some density is non-zero; a brick table keeps each brick's pool
+// offset and majorant, and a coarser occupancy level groups 4^3 bricks into blocks so that empty space is skipped a
+// block at a time. Memory scales with occupied bricks, plus 1/512 of the box for the table.
+class Voxel_grid : public Density_field {
+public:
+    static const int brick_size = 8;
+    static const int block_size = 4;
+
+    AABB bounds;
+
+    Voxel_grid() = default;
+
+    // Load a raw density volume (see Voxel_file_header) through mmap, keeping only its occupied bricks.
+    static bool load(const char *filename, Voxel_grid &grid);
+
+    // Build from a dense nx * ny * nz array, x varying fastest.
+    void build(const float *dense, int nx, int ny, int nz, const AABB &_bounds);
+
+    // Trilinearly interpolated density.
+    [[nodiscard]] double density(const Point3 &point) const override;
+
+    [[nodiscard]] double upper_bound() const override { return max_density; }
+
+    // The largest majorant of the bricks box overlaps.
+    [[nodiscard]] double region_bound(const AABB &box) const override;
+
+    [[nodiscard]] int brick_count(int axis) const { return bricks[axis]; }
+
+    [[nodiscard]] int block_count(int axis) const { return blocks[axis]; }
+
+    [[nodiscard]] Vec3 brick_extent() const { return brick_size * voxel_size; }
+
+    [[nodiscard]] Vec3 block_extent() const { return (brick_size * block_size) * voxel_size; }
+
+    // Upper bound of the interpolated density anywhere inside a brick (its own voxels plus a one-voxel apron).
+    [[nodiscard]] double brick_majorant(int bx, int by, int bz) const {
+        return brick_majorants[(bz * bricks[1] + by) * bricks[0] + bx];
+    }
+
+    [[nodiscard]] bool block_empty(int kx, int ky, int kz) const {
+        return block_majorants[(kz * blocks[1] + ky) * blocks[0] + kx] <= 0;
+    }
+
+    [[nodiscard]] size_t occupied_bricks() const { return brick_pool.size() / (brick_size * brick_size * brick_size); }
+
+    [[nodiscard]] size_t memory_bytes() const {
+        return brick_pool.size() * sizeof(float) + brick_index.size() * sizeof(std::int32_t)
+               + (brick_majorants.size() + block_majorants.size()) * sizeof(float);
+    }
+
+private:
+    int voxels[3] = {0, 0, 0};
+    int bricks[3] = {0, 0, 0};
+    int blocks[3] = {0, 0, 0};
+    Vec3 voxel_size;
+    double max_density = 0.0;
+
+    std::vector<std::int32_t> brick_index;  // brick -> first voxel in brick_pool, or -1 when empty
+    std::vector<float> brick_majorants;
+    std::vector<float> block_majorants;
+    std::vector<float> brick_pool;
+
+    [[nodiscard]] float voxel(int x, int y, int z) const;
+};
+
+bool Voxel_grid::load(const char *filename, Voxel_grid &grid) {
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0) {
+        std::cerr << "ERROR: Could not open voxel file '" << filename << "'.\n";
+        return false;
+    }
+
+    struct stat file_status{};
+    fstat(descriptor, &file_status);
+    auto file_size = static_cast<size_t>(file_status.st_size);
+
+    void *mapping = file_size > 0 ? mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+
+    if (mapping == MAP_FAILED) {
+        std::cerr << "ERROR: Could not map voxel file '" << filename << "'.\n";
+        return false;
+    }
+
+    Voxel_file_header header{};
+    bool valid = file_size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, mapping, sizeof(header));
+        valid = std::memcmp(header.magic, "RTVX", 4) == 0 && header.version == 1;
+    }
+
+    // Dimensions whose brick counts fit in an int, finite bounds with some extent on every axis, and all the voxels
+    // in the file, checked without overflowing the voxel count.
+    const auto max_voxels = static_cast<std::uint32_t>(std::numeric_limits<int>::max() / brick_size);
+    for (auto count: {header.nx, header.ny, header.nz}) { valid = valid && count > 0 && count <= max_voxels; }
+    for (int a = 0; valid && a < 3; ++a) {
+        valid = std::isfinite(header.bounds_min[a]) && std::isfinite(header.bounds_max[a]) &&
+                header.bounds_min[a] < header.bounds_max[a];
+    }
+    valid = valid && size_t(header.nx) * header.ny <= (file_size - sizeof(header)) / sizeof(float) / header.nz;
+
+    if (!valid) {
+        std::cerr << "ERROR: '" << filename << "' is not a valid voxel file.\n";
+        munmap(mapping, file_size);
+        return false;
+    }
+
+    auto dense = reinterpret_cast<const float *>(static_cast<const char *>(mapping) + sizeof(header));
+    grid.build(dense, static_cast<int>(header.nx), static_cast<int>(header.ny), static_cast<int>(header.nz),
+               AABB(Point3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]),
+                    Point3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2])));
+
+    munmap(mapping, file_size);
+    return true;
+}
+
+void Voxel_grid::build(const float *dense, int nx, int ny, int nz, const AABB &_bounds) {
+    bounds = _bounds;
+    voxels[0] = nx;
+    voxels[1] = ny;
+    voxels[2] = nz;
+    voxel_size = Vec3((bounds.max().x() - bounds.min().x()) / nx,
+                      (bounds.max().y() - bounds.min().y()) / ny,
+                      (bounds.max().z() - bounds.min().z()) / nz);
+
+    for (int a = 0; a < 3; ++a) {
+        bricks[a] = (voxels[a] + brick_size - 1) / brick_size;
+        blocks[a] = (bricks[a] + block_size - 1) / block_size;
+    }
+
+    const auto voxel_at = [&](int x, int y, int z) {
+        return dense[(size_t(z) * ny + y) * nx + x];
+    };
+
+    brick_index.assign(size_t(bricks[0]) * bricks[1] * bricks[2], -1);
+    brick_majorants.assign(brick_index.size(), 0.0f);
+    block_majorants.assign(size_t(blocks[0]) * blocks[1] * blocks[2], 0.0f);
+    brick_pool.clear();
+    max_density = 0.0;
+
+    for (int bz = 0; bz < bricks[2]; ++bz) {
+        for (int by = 0; by < bricks[1]; ++by) {
+            for (int bx = 0; bx < bricks[0]; ++bx) {
+                const int origin[3] = {bx * brick_size, by * brick_size, bz * brick_size};
+                auto own_max = 0.0f;
+                auto apron_max = 0.0f;
+
+                for (int z = std::max(origin[2] - 1, 0); z < std::min(origin[2] + brick_size + 1, nz); ++z) {
+                    for (int y = std::max(origin[1] - 1, 0); y < std::min(origin[1] + brick_size + 1, ny); ++y) {
+                        for (int x = std::max(origin[0] - 1, 0); x < std::min(origin[0] + brick_size + 1, nx); ++x) {
+                            auto value = voxel_at(x, y, z);
+                            apron_max = std::max(apron_max, value);
+
+                            bool inside = x >= origin[0] && x < origin[0] + brick_size
+                                          && y >= origin[1] && y < origin[1] + brick_size
+                                          && z >= origin[2] && z < origin[2] + brick_size;
+                            if (inside) { own_max = std::max(own_max, value); }
+                        }
+                    }
+                }
+
+                auto brick = (size_t(bz) * bricks[1] + by) * bricks[0] + bx;
+                brick_majorants[brick] = apron_max;
+
+                auto block = (size_t(bz / block_size) * blocks[1] + by / block_size) * blocks[0] + bx / block_size;
+                block_majorants[block] = std::max(block_majorants[block], apron_max);
+
+                if (own_max <= 0) { continue; }
+
+                max_density = std::max(max_density, double(own_max));
+                brick_index[brick] = static_cast<std::int32_t>(brick_pool.size());
+                brick_pool.resize(brick_pool.size() + brick_size * brick_size * brick_size, 0.0f);
+
+                auto *target = &brick_pool[brick_index[brick]];
+                for (int z = 0; z < brick_size && origin[2] + z < nz; ++z) {
+                    for (int y = 0; y < brick_size && origin[1] + y < ny; ++y) {
+                        for (int x = 0; x < brick_size && origin[0] + x < nx; ++x) {
+                            target[(z * brick_size + y) * brick_size + x] =
+                                    voxel_at(origin[0] + x, origin[1] + y, origin[2] + z);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    brick_pool.shrink_to_fit();
+}
+
+double Voxel_grid::region_bound(const AABB &box) const {
+    int first[3];
+    int last[3];
+    auto extent = brick_extent();
+    for (int a = 0; a < 3; ++a) {
+        first[a] = std::clamp(static_cast<int>(floor((box.min()[a] - bounds.min()[a]) / extent[a])), 0, bricks[a] - 1);
+        last[a] = std::clamp(static_cast<int>(floor((box.max()[a] - bounds.min()[a]) / extent[a])), 0, bricks[a] - 1);
+    }
+
+    auto bound = 0.0;
+    for (int bz = first[2]; bz <= last[2]; ++bz) {
+        for (int by = first[1]; by <= last[1]; ++by) {
+            for (int bx = first[0]; bx <= last[0]; ++bx) { bound = std::max(bound, brick_majorant(bx, by, bz)); }
+        }
+    }
+    return bound;
+}
+
+float Voxel_grid::voxel(int x, int y, int z) const {
+    if (x < 0 || y < 0 || z < 0 || x >= voxels[0] || y >= voxels[1] || z >= voxels[2]) { return 0.0f; }
+
+    auto brick = brick_index[(size_t(z / brick_size) * bricks[1] + y / brick_size) * bricks[0] + x / brick_size];
+    if (brick < 0) { return 0.0f; }
+
+    return brick_pool[brick + ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size];
+}
+
+double Voxel_grid::density(const Point3 &point) const {
+    // Voxel values sit at voxel centres.
+    auto gx = (point.x() - bounds.min().x()) / voxel_size.x() - 0.5;
+    auto gy = (point.y() - bounds.min().y()) / voxel_size.y() - 0.5;
+    auto gz = (point.z() - bounds.min().z()) / voxel_size.z() - 0.5;
+
+    auto x = static_cast<int>(floor(gx));
+    auto y = static_cast<int>(floor(gy));
+    auto z = static_cast<int>(floor(gz));
+    auto fx = gx - x;
+    auto fy = gy - y;
+    auto fz = gz - z;
+
+    auto accum = 0.0;
+    for (int k = 0; k < 2; ++k) {
+        for (int j = 0; j < 2; ++j) {
+            for (int i = 0; i < 2; ++i) {
+                accum += (i ? fx : 1 - fx) * (j ? fy : 1 - fy) * (k ? fz : 1 - fz) * voxel(x + i, y + j, z + k);
+            }
+        }
+    }
+
+    return accum;
+}
+
+// A participating medium read from a Voxel_grid.
+// Delta tracking walks the brick grid with a DDA, using each brick's majorant; a brick whose occupancy block is empty
+// sends the walk straight to the far side of the whole block.
+class Voxel_volume : public Hittable {
+public:
+    shared_ptr<Voxel_grid> grid;
+    shared_ptr<Material> phase_function;
+
+    Voxel_volume(shared_ptr<Voxel_grid> _grid, const shared_ptr<Texture> &texture)
+            : grid(std::move(_grid)), phase_function(make_shared<Isotropic>(texture)) {}
+
+    Voxel_volume(shared_ptr<Voxel_grid> _grid, Color color)
+            : grid(std::move(_grid)), phase_function(make_shared<Isotropic>(color)) {}
+
+    bool hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const override;
+
+    void finalize_hit(const Ray &ray, Hit_record &rec) const override {
+        rec.point = ray.at(rec.t);
+        rec.normal = Vec3(1, 0, 0); // arbitrary
+        rec.front_face = true;  // also arbitrary
+        rec.material_ptr = phase_function.get();
+    }
+
+    bool bounding_box(double time0, double time1, AABB &output_box) const override {
+        output_box = grid->bounds;
+        return true;
+    }
+
+    bool boundary_interval(const Ray &ray, double &t_enter, double &t_exit) const override {
+        return slab_interval(grid->bounds.min(), grid->bounds.max(), ray, t_enter, t_exit);
+    }
+};
+
+bool Voxel_volume::hit(const Ray &ray, double t_min, double t_max, Hit_record &rec) const {
+    RT_STAT_PRIMITIVE(Voxel_volume);
+
+    double t_enter;
+    double t_exit;
+
+    if (!boundary_interval(ray, t_enter, t_exit)) { return false; }
+
+    if (t_enter < t_min) { t_enter = t_min; }
+    if (t_exit > t_max) { t_exit = t_max; }
+    if (t_enter < 0) { t_enter = 0; }
+
+    if (t_enter >= t_exit) { return false; }
+
+    const auto ray_length = ray.direction().length();
+    const auto brick_extent = grid->brick_extent();
+    const auto block_extent = grid->block_extent();
+    const int brick_resolution[3] = {grid->brick_count(0), grid->brick_count(1), grid->brick_count(2)};
+    // Nudge past a skipped block's far face so the walk restarts in the next block.
+    const auto nudge = 1e-6 * fmin(brick_extent.x(), fmin(brick_extent.y(), brick_extent.z())) / ray_length;
+
+    auto t = t_enter;
+    while (t < t_exit) {
+        Grid_dda dda(ray, t, grid->bounds.min(), brick_extent, brick_resolution);
+        bool restart = false;
+
+        while (!restart && t < t_exit) {
+            const auto &brick = dda.cell;
+            auto cell_exit = fmin(dda.cell_exit(), t_exit);
+
+            const int block[3] = {brick[0] / Voxel_grid::block_size, brick[1] / Voxel_grid::block_size,
+                                  brick[2] / Voxel_grid::block_size};
+            if (grid->block_empty(block[0], block[1], block[2])) {
+                auto block_min = grid->bounds.min()
+                                 + Vec3(block[0] * block_extent.x(), block[1] * block_extent.y(),
+                                        block[2] * block_extent.z());
+                double block_enter;
+                double block_exit;
+                slab_interval(block_min, block_min + block_extent, ray, block_enter, block_exit);
+
+                t = fmax(block_exit, t) + nudge;
+                restart = true;
+                continue;
+            }
+
+            if (auto majorant = grid->brick_majorant(brick[0], brick[1], brick[2]); majorant > 0) {
+                while (true) {
+                    t -= log(1.0 - random_double()) / (majorant * ray_length);
+                    if (t >= cell_exit) { break; }
+
+                    if (random_double() * majorant < grid->density(ray.at(t))) {
+                        rec.set_hit(t, this);
+                        return true;
+                    }
+                }
+            }
+
+            t = cell_exit;
+            if (!dda.advance()) { return false; }
+        }
+    }
+
+    return false;
+}
+
+#endif //RAY_TRACING_IN_CPP_VOXEL_GRID_H